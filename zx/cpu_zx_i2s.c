@@ -8,8 +8,39 @@
 #include <linux/module.h>
 #include <linux/platform_device.h>
 #include <linux/pm_runtime.h>
+#include <linux/debugfs.h>
+#include <linux/bitfield.h>
+#include <linux/clk.h>
+#include <linux/clk-provider.h>
+#include <linux/clkdev.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
 #include <sound/soc.h>
+#include <sound/pcm_params.h>
 #include "zx_i2s.h"
+#include "zx_i2s_clk.h"
+
+/*
+ * rates the hw_rules offer, the clock planner decides which frames can carry
+ * them. 5512/7350/11000/14700/29400 are the odd telephony and legacy rates,
+ * 5512 and 11000 only come within a rate_tolerance (+90/+2272 ppm).
+ */
+static const unsigned int zxi2s_rates[] = {
+	5512, 6000, 7350, 8000, 11000, 11025, 12000, 14700, 16000, 22050,
+	24000, 29400, 32000, 44100, 48000, 64000, 88200, 96000, 128000,
+	144000, 176400, 192000,
+};
+
+static unsigned int rate_tolerance;
+module_param(rate_tolerance, uint, 0444);
+MODULE_PARM_DESC(rate_tolerance, "Largest rate error accepted from the clock planner, in ppm (default: 0, exact only; the machine driver may override it)");
+
+static unsigned int mclk_idle_ms = 2000;
+module_param(mclk_idle_ms, uint, 0644);
+MODULE_PARM_DESC(mclk_idle_ms, "Gate MCLK after it has been unused this long, in ms (default: 2000, 0: never gate)");
+
+/* wake latency histogram, bucket i: below 2^i us, the last one catches the rest */
+#define ZXI2S_WAKE_BUCKETS	16
 
 struct zxi2s_cpu {
 	/* controller resources information */
@@ -19,104 +50,519 @@ struct zxi2s_cpu {
     struct mutex lock;
     struct snd_soc_card *soc_card;
 
-	void __iomem *regs;
+	struct regmap *regmap;		/* shared with the dma device, owned by the PCI function */
 	int master;//zhuangzhuang add 2021/11/17
 	int active;
 	int lrck;
+	int frame_bits;		/* CHN_NUM slots of lrck bits */
 	int rate;
 	int pad_bits;
+	int tdm_slots;		/* set_tdm_slot(), 0: plain I2S */
+	int tdm_width;
+
+	struct zxi2s_clk_plan plan;	/* applied by the last hw_params */
+	unsigned int tolerance;		/* ppm, rate_tolerance or ZXI2S_CLKDIV_TOLERANCE */
+	/* per rate x LRDIV code, rate == 0: not within tolerance */
+	struct zxi2s_clk_plan plans[ARRAY_SIZE(zxi2s_rates)][ZXI2S_CLK_LRDIV_CODES];
+
+	/*
+	 * PLLEA and the DACIFCFG dividers are shared by every substream on the
+	 * link, whatever its PCM device or direction. A substream holds them
+	 * from hw_params to hw_free and every other one has to run the same
+	 * rate and frame meanwhile. Protected by lock.
+	 */
+	unsigned int clk_holders;	/* zxi2s_clk_holder() bits */
+	int clk_rate;
+	int clk_frame_bits;
+	unsigned long clk_shared;	/* hw_params joined another holder */
+	unsigned long clk_conflicts;	/* hw_params refused with -EBUSY */
+
+	/*
+	 * MCLK as a CCF clock: PLLEA picks one of two fixed PLLs, MDIV divides.
+	 * Held directions keep the rate exclusive, so clk_set_rate() of anybody
+	 * else can't move it under a running stream.
+	 */
+	struct clk_hw *pll_hw[2];	/* COMSET_SEL_PLLEA 0/1 */
+	struct clk_hw mclk_hw;
+	struct clk *mclk;		/* our own consumer handle */
 
+	/*
+	 * idle gating: prepare sets COMSET_MCLK_ALWAYS, unprepare clears it
+	 * mclk_idle_ms later. Gated, MCLK only runs while DAC/ADC is started.
+	 * prepare/unprepare are serialized by the clock core.
+	 */
+	struct delayed_work mclk_gate_work;
+	bool mclk_gated;
+	unsigned long mclk_gates;
+	unsigned long mclk_wakes;
+	unsigned long mclk_wake_hist[ZXI2S_WAKE_BUCKETS];
+	u64 mclk_wake_max_ns;
 };
 
-const static int PLL_TABLE[41][5] = {
-    /* 48 bit index = 0, num = 13 */
-    {48, 192000, 2 | 0 << 4, 0x1, 1},
-    {48,  96000, 2 | 2 << 4, 0x0, 1},
-    {48,  48000, 2 | 1 << 4, 0x2, 1},
-    {48,  32000, 2 | 5 << 4, 0x2, 1},
-    {48,  24000, 2 | 2 << 4, 0x2, 1},
-    {48,  16000, 2 | 2 << 4, 0xA, 1},
-    {48,   8000, 2 | 2 << 4, 0xB, 1},
-    {48,   6000, 2 | 2 << 4, 0x4, 1},
-    {48, 176400, 2 | 0 << 4, 0x1, 0},
-    {48,  88200, 2 | 2 << 4, 0x0, 0},
-    {48,  44100, 2 | 1 << 4, 0x2, 0},
-    {48,  22050, 2 | 2 << 4, 0x2, 0},
-    {48,  11025, 2 | 2 << 4, 0x3, 0},
-    /* 32 bit index = 13, num = 14 */
-    {32, 192000, 1 | 4 << 4, 0x1, 1},
-    {32, 144000, 1 | 2 << 4, 0x0, 1},
-    {32,  96000, 1 | 5 << 4, 0x1, 1},
-    {32,  48000, 1 | 5 << 4, 0x2, 1},
-    {32,  32000, 1 | 5 << 4, 0xA, 1},
-    {32,  24000, 1 | 2 << 4, 0xA, 1},
-    {32,  16000, 1 | 5 << 4, 0xB, 1},
-    {32,   8000, 1 | 6 << 4, 0xB, 1},
-    {32,   6000, 1 | 2 << 4, 0xC, 1},
-    {32, 176400, 1 | 4 << 4, 0x1, 0},
-    {32,  88200, 1 | 5 << 4, 0x1, 0},
-    {32,  44100, 1 | 5 << 4, 0x2, 0},
-    {32,  22050, 1 | 2 << 4, 0xA, 0},
-    {32,  11025, 1 | 2 << 4, 0xB, 0},
-    /* 64 bit index = 27, num = 14 */
-    {64, 192000, 0 | 4 << 4, 0x0, 1},
-    {64, 144000, 0 | 0 << 4, 0x1, 1},
-    {64,  96000, 0 | 4 << 4, 0x1, 1},
-    {64,  48000, 0 | 5 << 4, 0x1, 1},
-    {64,  32000, 0 | 5 << 4, 0x9, 1},
-    {64,  24000, 0 | 5 << 4, 0x2, 1},
-    {64,  16000, 0 | 5 << 4, 0xA, 1},
-    {64,   8000, 0 | 5 << 4, 0xB, 1},
-    {64,   6000, 0 | 2 << 4, 0xB, 1},
-    {64, 176400, 0 | 4 << 4, 0x0, 0},
-    {64,  88200, 0 | 4 << 4, 0x1, 0},
-    {64,  44100, 0 | 5 << 4, 0x1, 0},
-    {64,  22050, 0 | 5 << 4, 0x2, 0},
-    {64,  11025, 0 | 2 << 4, 0xA, 0}
+/* lrck (bits per channel slot) a sample format is sent with, 0: unsupported */
+static int zxi2s_format_lrck(snd_pcm_format_t format)
+{
+	return zxi2s_clk_lrck(snd_pcm_format_width(format));
+}
+
+static bool zxi2s_interval_has(const struct snd_interval *i, unsigned int val)
+{
+	return (i->openmin ? val > i->min : val >= i->min) &&
+	       (i->openmax ? val < i->max : val <= i->max);
+}
+
+/* clk_holders bit of a substream: one per PCM device and direction */
+#define ZXI2S_CLK_HOLDERS	(sizeof_field(struct zxi2s_cpu, clk_holders) * BITS_PER_BYTE)
+
+static unsigned int zxi2s_clk_holder(struct snd_pcm_substream *substream)
+{
+	unsigned int bit = substream->pcm->device * 2 + substream->stream;
+
+	/* the card has a device per dai_link, nowhere near this */
+	if (WARN_ON_ONCE(bit >= ZXI2S_CLK_HOLDERS))
+		bit = substream->stream;
+	return BIT(bit);
+}
+
+/*
+ * may @holder program @rate/@frame_bits: only if nobody else holds the
+ * clocks or they already run exactly that. Called with lock held.
+ */
+static int zxi2s_clk_claim(struct zxi2s_cpu *i2scpu, unsigned int holder,
+			   int rate, int frame_bits)
+{
+	unsigned int other = i2scpu->clk_holders & ~holder;
+
+	if (other && (rate != i2scpu->clk_rate || frame_bits != i2scpu->clk_frame_bits)) {
+		i2scpu->clk_conflicts++;
+		return -EBUSY;
+	}
+	return 0;
+}
+
+/* @holder programmed the clocks after zxi2s_clk_claim(). Called with lock held. */
+static void zxi2s_clk_hold(struct zxi2s_cpu *i2scpu, unsigned int holder,
+			   int rate, int frame_bits)
+{
+	if (i2scpu->clk_holders & ~holder)
+		i2scpu->clk_shared++;
+	if (!(i2scpu->clk_holders & holder))
+		clk_rate_exclusive_get(i2scpu->mclk);
+	i2scpu->clk_holders |= holder;
+	i2scpu->clk_rate = rate;
+	i2scpu->clk_frame_bits = frame_bits;
+}
+
+/* give the clocks up, the others may reprogram them. Called with lock held. */
+static void zxi2s_clk_release(struct zxi2s_cpu *i2scpu, unsigned int holder)
+{
+	if (i2scpu->clk_holders & holder)
+		clk_rate_exclusive_put(i2scpu->mclk);
+	i2scpu->clk_holders &= ~holder;
+}
+
+/*
+ * FIFO register images for a format. POP_LEN follows the container in the
+ * cyclic buffer (8/16/32 bit), the link itself always carries signed little
+ * endian samples, so unsigned and BE formats get the exchange bits.
+ * CHN_NUM is 2 bits wide: 4 slots encode as 0.
+ */
+static u8 zxi2s_dac_fifo_cfg(snd_pcm_format_t format, unsigned int channels)
+{
+	u8 cfg = channels & DACFIFOCFG_CHN_NUM;
+
+	switch (snd_pcm_format_physical_width(format)) {
+	case 16:
+		cfg |= 1 << 4;
+		break;
+	case 32:
+		cfg |= 2 << 4;
+		break;
+	}
+	if (snd_pcm_format_unsigned(format) > 0)
+		cfg |= DACFIFOCFG_SIGN_EXCHANGE;
+	if (snd_pcm_format_big_endian(format) > 0)
+		cfg |= DACFIFOCFG_ENDIAN_EXCHANGE;
+	return cfg;
+}
+
+/* capture FIFO has no converters, POP_LEN: 16 bit(1) / 32 bit(0) */
+static u8 zxi2s_adc_fifo_cfg(snd_pcm_format_t format)
+{
+	return snd_pcm_format_physical_width(format) == 16 ? ADCFIFOCFG_POP_LEN : 0;
+}
+
+/*
+ * hw_rules: only offer rate/format/channels combinations the clock generator
+ * can produce within the tolerance, so nothing ends up in the plug layer.
+ * The plans are keyed by frame bits. While another substream holds the
+ * clocks only its rate and frame are left. Every rule walks the combinations
+ * the other two parameters still allow and keeps what survives of its own.
+ */
+struct zxi2s_combos {
+	unsigned int rates[ARRAY_SIZE(zxi2s_rates)];
+	int nrates;
+	struct snd_mask formats;
+	unsigned int channels[ZXI2S_CHANNELS_MAX];
+	int nchannels;
 };
 
-static int zxi2s_setup_pll(struct zxi2s_cpu *dev)
+static void zxi2s_hw_combos(struct snd_pcm_substream *substream,
+			    struct snd_pcm_hw_params *params, struct zxi2s_combos *c)
+{
+	struct snd_soc_pcm_runtime *rtd = asoc_substream_to_rtd(substream);
+	struct zxi2s_cpu *i2scpu = snd_soc_dai_get_drvdata(asoc_rtd_to_cpu(rtd, 0));
+	struct snd_interval *r = hw_param_interval(params, SNDRV_PCM_HW_PARAM_RATE);
+	struct snd_interval *ch = hw_param_interval(params, SNDRV_PCM_HW_PARAM_CHANNELS);
+	struct snd_mask *fmt = hw_param_mask(params, SNDRV_PCM_HW_PARAM_FORMAT);
+	unsigned int chmask = 0, n;
+	snd_pcm_format_t f;
+	int i, lrck, lrdiv;
+	int lock_rate = 0, lock_frame = 0;
+
+	mutex_lock(&i2scpu->lock);
+	if (i2scpu->clk_holders & ~zxi2s_clk_holder(substream)) {
+		lock_rate = i2scpu->clk_rate;
+		lock_frame = i2scpu->clk_frame_bits;
+	}
+	mutex_unlock(&i2scpu->lock);
+
+	c->nrates = 0;
+	c->nchannels = 0;
+	snd_mask_none(&c->formats);
+
+	for (i = 0; i < ARRAY_SIZE(zxi2s_rates); i++) {
+		bool hit = false;
+
+		if (!zxi2s_interval_has(r, zxi2s_rates[i]) ||
+		    (lock_rate && zxi2s_rates[i] != lock_rate))
+			continue;
+		pcm_for_each_format(f) {
+			lrck = zxi2s_format_lrck(f);
+			if (!lrck || !snd_mask_test_format(fmt, f))
+				continue;
+			for (n = 1; n <= ZXI2S_CHANNELS_MAX; n++) {
+				lrdiv = zxi2s_clk_lrdiv(zxi2s_clk_frame_bits(lrck, n));
+				if (!zxi2s_interval_has(ch, n) || lrdiv < 0 ||
+				    !i2scpu->plans[i][lrdiv].rate ||
+				    (lock_frame && zxi2s_clk_frame_bits(lrck, n) != lock_frame))
+					continue;
+				hit = true;
+				snd_mask_set_format(&c->formats, f);
+				chmask |= BIT(n);
+			}
+		}
+		if (hit)
+			c->rates[c->nrates++] = zxi2s_rates[i];
+	}
+
+	for (n = 1; n <= ZXI2S_CHANNELS_MAX; n++) {
+		if (chmask & BIT(n))
+			c->channels[c->nchannels++] = n;
+	}
+}
+
+static int zxi2s_hw_rule_rate(struct snd_pcm_hw_params *params,
+			      struct snd_pcm_hw_rule *rule)
 {
+	struct zxi2s_combos c;
 
-    u8 start, end, index;
+	zxi2s_hw_combos(rule->private, params, &c);
+	return snd_interval_list(hw_param_interval(params, SNDRV_PCM_HW_PARAM_RATE),
+				 c.nrates, c.rates, 0);
+}
 
-    /* get proper regs */
-    if (dev->lrck == 24) {
-        start = 0;
-        end = start + 13;
-    } else if (dev->lrck == 16) {
-        start = 13;
-        end = start + 14;
-    } else {
-        start = 27;
-        end = start + 14;
-    }
+static int zxi2s_hw_rule_format(struct snd_pcm_hw_params *params,
+				struct snd_pcm_hw_rule *rule)
+{
+	struct zxi2s_combos c;
 
-    for (index = start; index < end; index ++) {
-        if (dev->rate == PLL_TABLE[index][1]) {
-            break;
-        }
-    }
+	zxi2s_hw_combos(rule->private, params, &c);
+	return snd_mask_refine(hw_param_mask(params, SNDRV_PCM_HW_PARAM_FORMAT),
+			       &c.formats);
+}
 
-    if (index >= end) {
-        return -ENODEV;
-    }
+static int zxi2s_hw_rule_channels(struct snd_pcm_hw_params *params,
+				  struct snd_pcm_hw_rule *rule)
+{
+	struct zxi2s_combos c;
 
-    /* set ws, rate, clock source related regs */
-    zxi2s_reg_writeb(dev, ZXI2S_REG_DACIFCF1, PLL_TABLE[index][2]); /* LRDIV | BDIV */
-    zxi2s_reg_updateb(dev, ZXI2S_REG_DACIFCF2, MDIV, PLL_TABLE[index][3]); /* MDIV */
-    zxi2s_reg_updateb(dev, ZXI2S_REG_COMSET, COMSET_SEL_PLLEA, PLL_TABLE[index][4]); /* PLLEA */
+	zxi2s_hw_combos(rule->private, params, &c);
+	return snd_interval_list(hw_param_interval(params, SNDRV_PCM_HW_PARAM_CHANNELS),
+				 c.nchannels, c.channels, 0);
+}
 
-    /* set pad bit reg */
-    if (direction == SNDRV_PCM_STREAM_PLAYBACK)
-        zxi2s_reg_writeb(dev, ZXI2S_REG_DACIFCF0, dev->pad_bits);
-    else
-        zxi2s_reg_updateb(dev, ZXI2S_REG_ADCIFCFG, ADCIFCFG_SDPAD, dev->pad_bits);
+/* plans of zxi2s_rates for every frame the WS divider can count, at probe and set_clkdiv */
+static void zxi2s_plan_rates(struct zxi2s_cpu *dev)
+{
+	static const unsigned int frames[ZXI2S_CLK_LRDIV_CODES] = { 64, 32, 48 };
+	struct zxi2s_clk_plan *plan;
+	int i, lrdiv;
 
-    return 0;
+	for (i = 0; i < ARRAY_SIZE(zxi2s_rates); i++) {
+		for (lrdiv = 0; lrdiv < ZXI2S_CLK_LRDIV_CODES; lrdiv++) {
+			plan = &dev->plans[i][lrdiv];
+			if (zxi2s_clk_plan(zxi2s_rates[i], frames[lrdiv], plan) ||
+			    abs(plan->err_ppm) > dev->tolerance)
+				plan->rate = 0;
+		}
+	}
 }
 
+/*
+ * clock part of the register image: DACIFCFG dividers (the link clocks of
+ * both directions come from DAC) and the PLL selection in COMSET.
+ */
+static int zxi2s_setup_pll(struct zxi2s_cpu *dev, u32 *ifcfg, u8 *comset)
+{
+	struct zxi2s_clk_plan plan;
+
+	if (zxi2s_clk_plan(dev->rate, dev->frame_bits, &plan) ||
+	    abs(plan.err_ppm) > dev->tolerance)
+		return -ENODEV;
+
+	/* ws, rate, clock source */
+	*ifcfg = FIELD_PREP(DACIFCFG_LRDIV, plan.lrdiv) |
+		 FIELD_PREP(DACIFCFG_BDIV, plan.bdiv) |
+		 FIELD_PREP(DACIFCFG_MDIV, plan.mdiv);
+	*comset = plan.pllea ? COMSET_SEL_PLLEA : 0;
+
+	dev->plan = plan;
+	dev_dbg(dev->dev, "%d Hz, %d bit frame: mclk %u, %d ppm\n",
+		dev->rate, dev->frame_bits, plan.mclk, plan.err_ppm);
+	return 0;
+}
+
+
+/*
+ * MCLK clock ops. hw_params writes the same MDIV/PLLEA the planner picked,
+ * the machine driver has set that rate through clk_set_rate() before (the
+ * link's hw_params runs first), and an exact MCLK has only one parent and
+ * MDIV code, so both writers agree. The ops don't take i2scpu->lock,
+ * hw_params calls into the clock core with it held.
+ */
+#define to_zxi2s_cpu(hw)	container_of(hw, struct zxi2s_cpu, mclk_hw)
+
+static u8 zxi2s_mclk_get_parent(struct clk_hw *hw)
+{
+	struct zxi2s_cpu *dev = to_zxi2s_cpu(hw);
+
+	return !!(zxi2s_reg_readb(dev, ZXI2S_REG_COMSET) & COMSET_SEL_PLLEA);
+}
+
+static int zxi2s_mclk_set_parent(struct clk_hw *hw, u8 index)
+{
+	struct zxi2s_cpu *dev = to_zxi2s_cpu(hw);
+
+	return zxi2s_reg_updateb(dev, ZXI2S_REG_COMSET, COMSET_SEL_PLLEA,
+				 index ? COMSET_SEL_PLLEA : 0);
+}
+
+static unsigned long zxi2s_mclk_recalc_rate(struct clk_hw *hw, unsigned long parent_rate)
+{
+	struct zxi2s_cpu *dev = to_zxi2s_cpu(hw);
+	u32 ifcfg = zxi2s_reg_readl(dev, ZXI2S_REG_DACIFCFG);
+
+	return parent_rate / zxi2s_clk_mdiv(FIELD_GET(DACIFCFG_MDIV, ifcfg));
+}
+
+static unsigned long zxi2s_mclk_err(unsigned long a, unsigned long b)
+{
+	return a > b ? a - b : b - a;
+}
+
+/* MDIV code closest to @rate from @parent_rate */
+static unsigned int zxi2s_mclk_code(unsigned long rate, unsigned long parent_rate)
+{
+	unsigned int code, best = 0;
+	unsigned long err, best_err = ULONG_MAX;
+
+	for (code = 0; code < ZXI2S_CLK_MDIV_CODES; code++) {
+		err = zxi2s_mclk_err(parent_rate / zxi2s_clk_mdiv(code), rate);
+		if (err < best_err) {
+			best_err = err;
+			best = code;
+		}
+	}
+	return best;
+}
+
+/* round_rate over both PLLs: the closest MCLK wins, the parent comes with it */
+static int zxi2s_mclk_determine_rate(struct clk_hw *hw, struct clk_rate_request *req)
+{
+	struct clk_hw *parent, *best_parent = NULL;
+	unsigned long prate, rate, best = 0;
+	int i;
+
+	for (i = 0; i < clk_hw_get_num_parents(hw); i++) {
+		parent = clk_hw_get_parent_by_index(hw, i);
+		if (!parent)
+			continue;
+		prate = clk_hw_get_rate(parent);
+		rate = prate / zxi2s_clk_mdiv(zxi2s_mclk_code(req->rate, prate));
+		if (!best_parent || zxi2s_mclk_err(rate, req->rate) < zxi2s_mclk_err(best, req->rate)) {
+			best = rate;
+			best_parent = parent;
+		}
+	}
+	if (!best_parent)
+		return -EINVAL;
+
+	req->rate = best;
+	req->best_parent_hw = best_parent;
+	req->best_parent_rate = clk_hw_get_rate(best_parent);
+	return 0;
+}
+
+static int zxi2s_mclk_set_rate(struct clk_hw *hw, unsigned long rate,
+			       unsigned long parent_rate)
+{
+	struct zxi2s_cpu *dev = to_zxi2s_cpu(hw);
+
+	return zxi2s_reg_updatel(dev, ZXI2S_REG_DACIFCFG, DACIFCFG_MDIV,
+				 FIELD_PREP(DACIFCFG_MDIV, zxi2s_mclk_code(rate, parent_rate)));
+}
+
+static int zxi2s_mclk_set_rate_and_parent(struct clk_hw *hw, unsigned long rate,
+					  unsigned long parent_rate, u8 index)
+{
+	int ret;
+
+	ret = zxi2s_mclk_set_parent(hw, index);
+	if (ret)
+		return ret;
+	return zxi2s_mclk_set_rate(hw, rate, parent_rate);
+}
+
+static void zxi2s_mclk_gate_work(struct work_struct *work)
+{
+	struct zxi2s_cpu *dev = container_of(to_delayed_work(work), struct zxi2s_cpu,
+					     mclk_gate_work);
+
+	if (zxi2s_reg_updateb(dev, ZXI2S_REG_COMSET, COMSET_MCLK_ALWAYS, 0))
+		return;
+	dev->mclk_gated = true;
+	dev->mclk_gates++;
+}
+
+/* ungate right away; the time it takes, a pending gate included, goes to the histogram */
+static int zxi2s_mclk_prepare(struct clk_hw *hw)
+{
+	struct zxi2s_cpu *dev = to_zxi2s_cpu(hw);
+	u64 t0 = ktime_get_ns(), ns;
+	int ret, i;
+
+	cancel_delayed_work_sync(&dev->mclk_gate_work);
+	if (!dev->mclk_gated)
+		return 0;
+
+	ret = zxi2s_reg_updateb(dev, ZXI2S_REG_COMSET, COMSET_MCLK_ALWAYS,
+				COMSET_MCLK_ALWAYS);
+	if (ret)
+		return ret;
+	dev->mclk_gated = false;
+
+	ns = ktime_get_ns() - t0;
+	i = min_t(int, fls64(div_u64(ns, NSEC_PER_USEC)), ZXI2S_WAKE_BUCKETS - 1);
+	dev->mclk_wake_hist[i]++;
+	dev->mclk_wakes++;
+	dev->mclk_wake_max_ns = max(dev->mclk_wake_max_ns, ns);
+	return 0;
+}
+
+static void zxi2s_mclk_unprepare(struct clk_hw *hw)
+{
+	struct zxi2s_cpu *dev = to_zxi2s_cpu(hw);
+	unsigned int idle = READ_ONCE(mclk_idle_ms);
+
+	if (idle)
+		schedule_delayed_work(&dev->mclk_gate_work, msecs_to_jiffies(idle));
+}
+
+static int zxi2s_mclk_is_prepared(struct clk_hw *hw)
+{
+	return !to_zxi2s_cpu(hw)->mclk_gated;
+}
+
+static const struct clk_ops zxi2s_mclk_ops = {
+	.prepare		= zxi2s_mclk_prepare,
+	.unprepare		= zxi2s_mclk_unprepare,
+	.is_prepared		= zxi2s_mclk_is_prepared,
+	.get_parent		= zxi2s_mclk_get_parent,
+	.set_parent		= zxi2s_mclk_set_parent,
+	.recalc_rate		= zxi2s_mclk_recalc_rate,
+	.determine_rate		= zxi2s_mclk_determine_rate,
+	.set_rate		= zxi2s_mclk_set_rate,
+	.set_rate_and_parent	= zxi2s_mclk_set_rate_and_parent,
+};
+
+static void zxi2s_unregister_pll(void *hw)
+{
+	clk_hw_unregister_fixed_rate(hw);
+}
+
+/* a gate still pending at unbind is done here, nothing is left queued */
+static void zxi2s_cancel_mclk_gate(void *data)
+{
+	struct zxi2s_cpu *dev = data;
+
+	if (cancel_delayed_work_sync(&dev->mclk_gate_work))
+		zxi2s_mclk_gate_work(&dev->mclk_gate_work.work);
+}
+
+/* PLLEA parents, MCLK and the ZXI2S_MCLK_NAME lookup for the machine driver */
+static int zxi2s_register_mclk(struct zxi2s_cpu *dev)
+{
+	static const char * const names[] = { "zxi2s_pll_33m", "zxi2s_pll_36m" };
+	static const unsigned long rates[] = { ZXI2S_PLL_33M, ZXI2S_PLL_36M };
+	struct clk_init_data init = {};
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(dev->pll_hw); i++) {
+		dev->pll_hw[i] = clk_hw_register_fixed_rate(dev->dev, names[i], NULL,
+							    0, rates[i]);
+		if (IS_ERR(dev->pll_hw[i]))
+			return PTR_ERR(dev->pll_hw[i]);
+		ret = devm_add_action_or_reset(dev->dev, zxi2s_unregister_pll,
+					       dev->pll_hw[i]);
+		if (ret)
+			return ret;
+	}
+
+	/*
+	 * nobody holds MCLK yet: whatever the firmware left in COMSET, gate it
+	 * after the quiet period. Registered before the clock so that the
+	 * cancel runs after the clock is gone and unprepare can't queue the
+	 * work again; and after the i2scpu allocation, so the work never runs
+	 * on freed memory.
+	 */
+	INIT_DELAYED_WORK(&dev->mclk_gate_work, zxi2s_mclk_gate_work);
+	ret = devm_add_action_or_reset(dev->dev, zxi2s_cancel_mclk_gate, dev);
+	if (ret)
+		return ret;
+	dev->mclk_gated = !(zxi2s_reg_readb(dev, ZXI2S_REG_COMSET) & COMSET_MCLK_ALWAYS);
+	if (!dev->mclk_gated && mclk_idle_ms)
+		schedule_delayed_work(&dev->mclk_gate_work, msecs_to_jiffies(mclk_idle_ms));
+
+	init.name = ZXI2S_MCLK_NAME;
+	init.ops = &zxi2s_mclk_ops;
+	init.parent_hws = (const struct clk_hw **)dev->pll_hw;
+	init.num_parents = ARRAY_SIZE(dev->pll_hw);
+	init.flags = CLK_GET_RATE_NOCACHE;
+	dev->mclk_hw.init = &init;
+
+	ret = devm_clk_hw_register(dev->dev, &dev->mclk_hw);
+	if (ret)
+		return ret;
 
+	dev->mclk = devm_clk_hw_get_clk(dev->dev, &dev->mclk_hw, "cpu");
+	if (IS_ERR(dev->mclk))
+		return PTR_ERR(dev->mclk);
+
+	/* no dev_id: whoever asks for ZXI2S_MCLK_NAME gets it */
+	return devm_clk_hw_register_clkdev(dev->dev, &dev->mclk_hw,
+					   ZXI2S_MCLK_NAME, NULL);
+}
 
 
 static void zxi2s_start(struct zxi2s_cpu *dev,
@@ -124,13 +570,13 @@ static void zxi2s_start(struct zxi2s_cpu *dev,
 {
 
 	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK){
-		zxi2s_reg_writel(dev,ZXI2S_REG_INTCTRL,INTCTRL_OUT);
-		zxi2s_reg_writel(dev, ZXI2S_REG_OSDINTE, OSDINTE_ALL);
+		zxi2s_reg_updateb(dev, ZXI2S_REG_INTCTRL, INTCTRL_OUT, INTCTRL_OUT);
+		zxi2s_reg_writeb(dev, ZXI2S_REG_OSDINTE, OSDINTE_ALL);
 		}
 	else{
 		//i2s_enable_irqs
-		zxi2s_reg_writel(dev,ZXI2S_REG_INTCTRL,INTCTRL_IN);
-		zxi2s_reg_writel(dev, ZXI2S_REG_ISDINTE, OSDINTE_ALL);
+		zxi2s_reg_updateb(dev, ZXI2S_REG_INTCTRL, INTCTRL_IN, INTCTRL_IN);
+		zxi2s_reg_writeb(dev, ZXI2S_REG_ISDINTE, ISDINTE_ALL);
 		}
 
 }
@@ -140,12 +586,12 @@ static void zxi2s_stop(struct zxi2s_cpu *dev,
 {
 				  
 	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK){
-		zxi2s_reg_writel(dev,ZXI2S_REG_INTCTRL,~INTCTRL_OUT);
-		zxi2s_reg_writel(dev, ZXI2S_REG_OSDINTE, 0);
+		zxi2s_reg_updateb(dev, ZXI2S_REG_INTCTRL, INTCTRL_OUT, 0);
+		zxi2s_reg_writeb(dev, ZXI2S_REG_OSDINTE, 0);
 		}
 	 else{
-	 	zxi2s_reg_writel(dev,ZXI2S_REG_INTCTRL,~INTCTRL_IN);
-		zxi2s_reg_writel(dev, ZXI2S_REG_ISDINTE, 0);
+	 	zxi2s_reg_updateb(dev, ZXI2S_REG_INTCTRL, INTCTRL_IN, 0);
+		zxi2s_reg_writeb(dev, ZXI2S_REG_ISDINTE, 0);
 	 	}
 
 }
@@ -154,111 +600,169 @@ static int zxi2s_cpu_startup(struct snd_pcm_substream *substream,
 		struct snd_soc_dai *cpu_dai)
 {
 	//设置dai DMA相关信息，我们不需要
+	struct zxi2s_cpu *i2scpu = snd_soc_dai_get_drvdata(cpu_dai);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	int ret;
 
-	return 0;
+	/* a TDM link carries exactly the configured slots */
+	if (i2scpu->tdm_slots && substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
+		ret = snd_pcm_hw_constraint_single(runtime, SNDRV_PCM_HW_PARAM_CHANNELS,
+						   i2scpu->tdm_slots);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* rate, format and channels depend on each other through the frame bits,
+	 * and on the clocks another substream holds */
+	ret = snd_pcm_hw_rule_add(runtime, 0, SNDRV_PCM_HW_PARAM_RATE,
+				  zxi2s_hw_rule_rate, substream,
+				  SNDRV_PCM_HW_PARAM_FORMAT,
+				  SNDRV_PCM_HW_PARAM_CHANNELS, -1);
+	if (ret < 0)
+		return ret;
+
+	ret = snd_pcm_hw_rule_add(runtime, 0, SNDRV_PCM_HW_PARAM_CHANNELS,
+				  zxi2s_hw_rule_channels, substream,
+				  SNDRV_PCM_HW_PARAM_FORMAT,
+				  SNDRV_PCM_HW_PARAM_RATE, -1);
+	if (ret < 0)
+		return ret;
+
+	return snd_pcm_hw_rule_add(runtime, 0, SNDRV_PCM_HW_PARAM_FORMAT,
+				   zxi2s_hw_rule_format, substream,
+				   SNDRV_PCM_HW_PARAM_RATE,
+				   SNDRV_PCM_HW_PARAM_CHANNELS, -1);
 }
 
 
 
-static int zxi2s_cpu_hw_params(struct snd_pcm_substream *substream,
+/* called with i2scpu->lock held */
+static int zxi2s_cpu_set_params(struct snd_pcm_substream *substream,
 		struct snd_pcm_hw_params *params, struct snd_soc_dai *cpu_dai)
 {
 	struct zxi2s_cpu *i2scpu = snd_soc_dai_get_drvdata(cpu_dai);
 
 	
-	struct snd_pcm_runtime *runtime = substream->runtime;
 	   snd_pcm_format_t format = params_format(params);
 	   u8 fifo_cfg = 0;
 	   u8 width, channels;
-	   u8 packed_bits; /* Samples are packed in cyclic buffer which are 8 bits, 16 bits, or 32 bits wide */
+	   struct reg_sequence img[2];
+	   u32 clk;
+	   u8 comset;
+	   int n = 0;
 	   int ret;
+	   int rate, frame_bits;
+	   unsigned int holder = zxi2s_clk_holder(substream);
 	
-	//P-spec 1.2.6 always output MCLK
-	zxi2s_reg_writeb(i2scpu, ZXI2S_REG_COMSET, COMSET_MCLK_ALWAYS);
-
 	/* get lrck: word length */
 	   width = snd_pcm_format_width(format);
-	   switch (width) {
-		   case 8:
-			   i2scpu->lrck = 16;
-			   packed_bits = 8;
-			   break;
-		   case 16:
-			   i2scpu->lrck = 16;
-			   packed_bits = 16;
-			   break;
-		   case 20:
-		   case 24:
-			   i2scpu->lrck = 24; /* TODO: debug mode use 32 bit instead */
-			   packed_bits = 32;
-			   break;
-		   case 32:
-			   i2scpu->lrck = 32;
-			   packed_bits = 32;
-			   break;
-		   default:
-			   dev_err(dai->dev, "unsupported width: %d\n", width);
-			   return -EINVAL;
+	   i2scpu->lrck = zxi2s_format_lrck(format);
+	   if (!i2scpu->lrck) {
+		   dev_err(i2scpu->dev, "unsupported width: %d\n", width);
+		   return -EINVAL;
 	   }
 	
-	   /* set pll values to regs */
+	   if (i2scpu->tdm_slots && i2scpu->lrck != i2scpu->tdm_width) {
+		   dev_err(i2scpu->dev, "%d bit samples in %d bit slots\n",
+				   width, i2scpu->tdm_width);
+		   return -EINVAL;
+	   }
+
+	   /* everything is checked before the first register write */
+	   channels = params_channels(params);
+	   if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK &&
+	       (channels < 1 || channels > ZXI2S_CHANNELS_MAX)) {
+		   dev_err(i2scpu->dev, "%d channels not supported\n", channels);
+		   return -EINVAL;
+	   }
+	   if (substream->stream == SNDRV_PCM_STREAM_CAPTURE &&
+	       !(ZXI2S_CAPTURE_FORMATS & pcm_format_to_bits(format))) {
+		   dev_err(i2scpu->dev, "unsupported capture format: %s\n",
+				   snd_pcm_format_name(format));
+		   return -EINVAL;
+	   }
+
+	   /* capture is always a stereo frame */
+	   frame_bits = zxi2s_clk_frame_bits(i2scpu->lrck,
+			   substream->stream == SNDRV_PCM_STREAM_PLAYBACK ? channels : 2);
+	   rate = params_rate(params);
+
+	   /* never reprogram the clocks under another substream */
+	   if (zxi2s_clk_claim(i2scpu, holder, rate, frame_bits)) {
+		   dev_err(i2scpu->dev, "%d Hz, %d bit frame: clocks busy at %d Hz, %d bit frame\n",
+				   rate, frame_bits, i2scpu->clk_rate, i2scpu->clk_frame_bits);
+		   return -EBUSY;
+	   }
+
+	   /* clock dividers for frame_bits x rate */
+	   i2scpu->frame_bits = frame_bits;
 	   i2scpu->pad_bits = i2scpu->lrck - width;
-	   i2scpu->rate = params_rate(params);
-	   if(zxi2s_setup_pll(i2scpu)) {
-		   dev_err(dai->dev, "unsupported rate: %d\n",
+	   i2scpu->rate = rate;
+	   if(zxi2s_setup_pll(i2scpu, &clk, &comset)) {
+		   dev_err(i2scpu->dev, "unsupported rate: %d\n",
 				   i2scpu->rate);
 		   return -EINVAL;
 	   }
 	
+	   /*
+	    * the whole image of this direction is computed here and written in one
+	    * burst, trigger only flips DACIFCFG_START/ADCFIFOCFG_START.
+	    * COMSET_MCLK_ALWAYS belongs to the MCLK clock (idle gating), here only
+	    * master or slave mode.
+	    */
+	   comset |= i2scpu->master ? 0 : COMSET_SLV_MODE;
+	   zxi2s_reg_updateb(i2scpu, ZXI2S_REG_COMSET,
+			     COMSET_SLV_MODE | COMSET_SEL_PLLEA, comset);
+
 	   if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
-		   /* set sample quantization for playback */
-		   if (packed_bits == 16)
-			   fifo_cfg |= 1 << 4;
-		   else if (packed_bits == 32)
-			   fifo_cfg |= 2 << 4;
-	
-		   /* get signed format */
-		   if (snd_pcm_format_signed(runtime->format))
-			   fifo_cfg |= DACFIFOCFG_SIGN_EXCHANGE;
-		   else
-			   fifo_cfg &= ~DACFIFOCFG_SIGN_EXCHANGE;
-	
-		   /* get big/little endian */
-		   if (snd_pcm_format_big_endian(runtime->format))
-			   fifo_cfg |= DACFIFOCFG_ENDIAN_EXCHANGE;
-		   else
-			   fifo_cfg &= ~DACFIFOCFG_ENDIAN_EXCHANGE;
-	
-		   /* get channel number */
-		   channels = params_channels(params);
-		   if (channels == 2 || channels == 1) {
-			   fifo_cfg |= channels;
-		   } else {
-			   dev_err(dai->dev, "%d channels not supported\n", channels);
-			   return -EINVAL;
-		   }
-	
-		   /* set format to regs */
-		   zxi2s_reg_writeb(i2scpu, ZXI2S_REG_DACFIFOCFG, fifo_cfg);
+		   /* data/WS change on the negative edge, left channel on low WS, START clear */
+		   img[n++] = (struct reg_sequence){ ZXI2S_REG_DACIFCFG, clk | i2scpu->pad_bits };
+		   /* pop length, sign/endian exchange and channels, the only DACFIFOCFG write */
+		   fifo_cfg = zxi2s_dac_fifo_cfg(format, channels);
+		   img[n++] = (struct reg_sequence){ ZXI2S_REG_DACFIFOCFG, fifo_cfg };
 	   } else {
-		   /* set pop size for capture or sample quantization for playback */
-		   if (packed_bits == 16)
-			   zxi2s_reg_writeb(i2scpu, ZXI2S_REG_ADCFIFOCFG, 2);
-		   else if (packed_bits == 32)
-			   zxi2s_reg_writeb(i2scpu, ZXI2S_REG_ADCFIFOCFG, 0);
-		   else ; /* TODO: capture only support 16, 32 */
+		   /* the clocks come from DAC, leave its interface bits alone */
+		   zxi2s_reg_updatel(i2scpu, ZXI2S_REG_DACIFCFG,
+				     DACIFCFG_MDIV | DACIFCFG_BDIV | DACIFCFG_LRDIV, clk);
+		   img[n++] = (struct reg_sequence){ ZXI2S_REG_ADCIFCFG,
+			   ADCIFCFG_NEGATIVE_EDGE | ADCIFCFG_LEFT_IN_LOW | i2scpu->pad_bits };
+		   img[n++] = (struct reg_sequence){ ZXI2S_REG_ADCFIFOCFG,
+			   zxi2s_adc_fifo_cfg(format) };
 	   }
-	
-	   /* set master or slave mode */
-	   if (i2scpu->master)
-		   zxi2s_reg_updateb(i2scpu, ZXI2S_REG_COMSET, COMSET_SLV_MODE, 0);
-	   else
-		   zxi2s_reg_updateb(i2scpu, ZXI2S_REG_COMSET, COMSET_SLV_MODE, COMSET_SLV_MODE);
-	
+
+	   ret = regmap_multi_reg_write(i2scpu->regmap, img, n);
+	   if (ret)
+		   return ret;
+
+	   zxi2s_clk_hold(i2scpu, holder, rate, frame_bits);
 	   return 0;
 
 }
 
+static int zxi2s_cpu_hw_params(struct snd_pcm_substream *substream,
+		struct snd_pcm_hw_params *params, struct snd_soc_dai *cpu_dai)
+{
+	struct zxi2s_cpu *i2scpu = snd_soc_dai_get_drvdata(cpu_dai);
+	int ret;
+
+	mutex_lock(&i2scpu->lock);
+	ret = zxi2s_cpu_set_params(substream, params, cpu_dai);
+	mutex_unlock(&i2scpu->lock);
+	return ret;
+}
+
+/* give the clocks up, the other substreams may reprogram them from now on */
+static int zxi2s_cpu_hw_free(struct snd_pcm_substream *substream,
+		struct snd_soc_dai *cpu_dai)
+{
+	struct zxi2s_cpu *i2scpu = snd_soc_dai_get_drvdata(cpu_dai);
+
+	mutex_lock(&i2scpu->lock);
+	zxi2s_clk_release(i2scpu, zxi2s_clk_holder(substream));
+	mutex_unlock(&i2scpu->lock);
+	return 0;
+}
+
 
 
 static void zxi2s_cpu_shutdown(struct snd_pcm_substream *substream,
@@ -349,13 +853,67 @@ static int zxi2s_cpu_set_fmt(struct snd_soc_dai *cpu_dai, unsigned int fmt)
 
 }
 
+/*
+ * TDM: the DAC serializes up to ZXI2S_CHANNELS_MAX slots per frame, in order
+ * and without gaps, and the WS divider has to count the frame. Capture
+ * stays a stereo I2S frame.
+ */
+static int zxi2s_cpu_set_tdm_slot(struct snd_soc_dai *cpu_dai, unsigned int tx_mask,
+				  unsigned int rx_mask, int slots, int slot_width)
+{
+	struct zxi2s_cpu *i2scpu = snd_soc_dai_get_drvdata(cpu_dai);
+
+	if (!slots) {
+		i2scpu->tdm_slots = 0;
+		return 0;
+	}
+
+	if (slots < 2 || slots > ZXI2S_CHANNELS_MAX ||
+	    tx_mask != GENMASK(slots - 1, 0) || (rx_mask && rx_mask != GENMASK(1, 0)))
+		return -EINVAL;
+
+	if (zxi2s_clk_lrdiv(slots * slot_width) < 0)
+		return -EINVAL;
+
+	i2scpu->tdm_slots = slots;
+	i2scpu->tdm_width = slot_width;
+	return 0;
+}
+
+/*
+ * ZXI2S_CLKDIV_TOLERANCE: the machine driver widens (or narrows) the rate
+ * error the planner may leave, e.g. when the codec ASRC absorbs it. The
+ * offered rates are planned again, so only while no stream holds the clocks.
+ */
+static int zxi2s_cpu_set_clkdiv(struct snd_soc_dai *cpu_dai, int div_id, int div)
+{
+	struct zxi2s_cpu *i2scpu = snd_soc_dai_get_drvdata(cpu_dai);
+	int ret = 0;
+
+	if (div_id != ZXI2S_CLKDIV_TOLERANCE || div < 0)
+		return -EINVAL;
+
+	mutex_lock(&i2scpu->lock);
+	if (i2scpu->clk_holders) {
+		ret = -EBUSY;
+	} else {
+		i2scpu->tolerance = div;
+		zxi2s_plan_rates(i2scpu);
+	}
+	mutex_unlock(&i2scpu->lock);
+	return ret;
+}
+
 static const struct snd_soc_dai_ops zxi2s_cpu_dai_ops = {
         .startup        = zxi2s_cpu_startup,
         .shutdown       = zxi2s_cpu_shutdown,
         .hw_params      = zxi2s_cpu_hw_params,//设置硬件参数（必须）
+        .hw_free        = zxi2s_cpu_hw_free,
         .prepare        = zxi2s_cpu_prepare,
         .trigger        = zxi2s_cpu_trigger,//触发条件（必须）
         .set_fmt        = zxi2s_cpu_set_fmt,//设置dai的格式
+        .set_tdm_slot   = zxi2s_cpu_set_tdm_slot,
+        .set_clkdiv     = zxi2s_cpu_set_clkdiv,
 };
 
 static struct snd_soc_dai_driver zxi2s_cpu_dai_drv = {
@@ -363,29 +921,245 @@ static struct snd_soc_dai_driver zxi2s_cpu_dai_drv = {
         .ops = &zxi2s_cpu_dai_ops,
 
         .playback = {
-                .rates = SNDRV_PCM_RATE_8000_96000,
-                .formats = SNDRV_PCM_FMTBIT_S16_LE | SNDRV_PCM_FMTBIT_S8 |
-                        SNDRV_PCM_FMTBIT_U8 | SNDRV_PCM_FMTBIT_S24_LE |
-                        SNDRV_PCM_FMTBIT_S32_LE,
+                .rates = SNDRV_PCM_RATE_KNOT,	/* list from the clock planner */
+                .formats = ZXI2S_PLAYBACK_FORMATS,
                 .channels_min = 2,
-                .channels_max = 2,
-                .rate_min = 8000,
-                .rate_max = 96000,
+                /* 4 needs a 4-slot codec, the RT5645 AIF1 stops at 2 */
+                .channels_max = ZXI2S_CHANNELS_MAX,
+                .rate_min = 5512,
+                .rate_max = 192000,
         },
         .capture = {
-                .rates = SNDRV_PCM_RATE_8000_48000,
-                .formats = SNDRV_PCM_FMTBIT_S16_LE | SNDRV_PCM_FMTBIT_S8 |
-                        SNDRV_PCM_FMTBIT_U8 | SNDRV_PCM_FMTBIT_S24_LE |
-                        SNDRV_PCM_FMTBIT_S32_LE,
+                .rates = SNDRV_PCM_RATE_KNOT,
+                .formats = ZXI2S_CAPTURE_FORMATS,
                 .channels_min = 2,
                 .channels_max = 2,
-                .rate_min = 8000,
-                .rate_max = 48000,
+                .rate_min = 5512,
+                .rate_max = 192000,
         },
 };
 
+#ifdef CONFIG_DEBUG_FS
+/* codec end of the link this DAI sits on, NULL while no card is bound */
+static struct snd_soc_pcm_stream *zxi2s_codec_stream(struct snd_soc_component *component,
+						     int dir)
+{
+	struct snd_soc_pcm_runtime *rtd;
+	struct snd_soc_dai *codec_dai;
+
+	if (!component->card)
+		return NULL;
+	for_each_card_rtds(component->card, rtd) {
+		if (asoc_rtd_to_cpu(rtd, 0)->component != component)
+			continue;
+		codec_dai = asoc_rtd_to_codec(rtd, 0);
+		if (snd_soc_dai_stream_valid(codec_dai, dir))
+			return snd_soc_dai_get_pcm_stream(codec_dai, dir);
+	}
+	return NULL;
+}
+
+/* the codec takes @f with @ch channels (soc_pcm intersects formats and channels) */
+static bool zxi2s_codec_takes(const struct snd_soc_pcm_stream *cs,
+			      snd_pcm_format_t f, unsigned int ch)
+{
+	return cs && (cs->formats & pcm_format_to_bits(f)) &&
+	       ch >= cs->channels_min && ch <= cs->channels_max;
+}
+
+/* the codec takes @rate, a rate bitmask without KNOT drops every other rate */
+static bool zxi2s_codec_takes_rate(const struct snd_soc_pcm_stream *cs,
+				   unsigned int rate)
+{
+	if ((cs->rate_min && rate < cs->rate_min) ||
+	    (cs->rate_max && rate > cs->rate_max))
+		return false;
+	if (cs->rates & (SNDRV_PCM_RATE_KNOT | SNDRV_PCM_RATE_CONTINUOUS))
+		return true;
+	return snd_pcm_rate_to_rate_bit(rate) & cs->rates;
+}
+
+/*
+ * every format x channels x rate combination the DAI accepts, as the hw_rules
+ * see it. Rates after "|" pass the cpu DAI but not the codec of the card, so
+ * they can never be negotiated on it.
+ */
+static int zxi2s_cpu_rates_show(struct seq_file *m, void *v)
+{
+	const struct snd_soc_pcm_stream *streams[] = {
+		&zxi2s_cpu_dai_drv.playback, &zxi2s_cpu_dai_drv.capture,
+	};
+	struct snd_soc_component *component = m->private;
+	struct zxi2s_cpu *i2scpu = snd_soc_component_get_drvdata(component);
+	const struct snd_soc_pcm_stream *cs;
+	snd_pcm_format_t f;
+	unsigned int ch;
+	int dir, i, lrck, lrdiv, pass;
+	bool card, sep;
+
+	for (dir = 0; dir < ARRAY_SIZE(streams); dir++) {
+		cs = zxi2s_codec_stream(component, dir);
+		seq_printf(m, "%s:", dir == SNDRV_PCM_STREAM_PLAYBACK ?
+			   "playback" : "capture");
+		if (cs)
+			seq_printf(m, " codec %s, %u-%uch\n", cs->stream_name ? : "?",
+				   cs->channels_min, cs->channels_max);
+		else
+			seq_puts(m, " no card, cpu DAI only\n");
+		pcm_for_each_format(f) {
+			if (!(streams[dir]->formats & pcm_format_to_bits(f)))
+				continue;
+			lrck = zxi2s_format_lrck(f);
+			for (ch = streams[dir]->channels_min;
+			     ch <= streams[dir]->channels_max; ch++) {
+				seq_printf(m, "  %-8s %uch frame %3d:", snd_pcm_format_name(f),
+					   ch, zxi2s_clk_frame_bits(lrck, ch));
+				lrdiv = zxi2s_clk_lrdiv(zxi2s_clk_frame_bits(lrck, ch));
+				sep = false;
+				/* what the card can open first, cpu-only rates after "|" */
+				for (pass = 0; lrdiv >= 0 && pass < (cs ? 2 : 1); pass++) {
+					for (i = 0; i < ARRAY_SIZE(zxi2s_rates); i++) {
+						if (!i2scpu->plans[i][lrdiv].rate ||
+						    zxi2s_rates[i] < streams[dir]->rate_min ||
+						    zxi2s_rates[i] > streams[dir]->rate_max)
+							continue;
+						card = !cs || (zxi2s_codec_takes(cs, f, ch) &&
+							       zxi2s_codec_takes_rate(cs, zxi2s_rates[i]));
+						if (card != !pass)
+							continue;
+						if (pass && !sep) {
+							seq_puts(m, " |");
+							sep = true;
+						}
+						seq_printf(m, " %d", zxi2s_rates[i]);
+					}
+				}
+				seq_puts(m, "\n");
+			}
+		}
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(zxi2s_cpu_rates);
+
+static void zxi2s_cpu_plan_show(struct seq_file *m, const struct zxi2s_clk_plan *plan)
+{
+	seq_printf(m, " %6u Hz %+7d ppm  pllea %d mdiv %2u bdiv %u lrdiv %u  mclk %8u (%ufs)\n",
+		   plan->rate, plan->err_ppm, plan->pllea, plan->mdiv, plan->bdiv,
+		   plan->lrdiv, plan->mclk, plan->mclk / plan->rate);
+}
+
+/* dividers the clock planner picked, for the last hw_params and every offered rate */
+static int zxi2s_cpu_clk_plan_show(struct seq_file *m, void *v)
+{
+	static const unsigned int frames[ZXI2S_CLK_LRDIV_CODES] = { 64, 32, 48 };
+	struct zxi2s_cpu *i2scpu = m->private;
+	unsigned long holders;
+	int i, lrdiv;
+
+	mutex_lock(&i2scpu->lock);
+	seq_printf(m, "tolerance %u ppm\nholders:", i2scpu->tolerance);
+	/* pcmD[pc] as in /proc/asound */
+	holders = i2scpu->clk_holders;
+	for_each_set_bit(i, &holders, ZXI2S_CLK_HOLDERS)
+		seq_printf(m, " pcm%d%c", i / 2, i % 2 ? 'c' : 'p');
+	seq_printf(m, ", %d Hz, %d bit frame, %lu shared, %lu conflicts\n",
+		   i2scpu->clk_rate, i2scpu->clk_frame_bits,
+		   i2scpu->clk_shared, i2scpu->clk_conflicts);
+	seq_printf(m, "current: %d Hz, %d bit frame:", i2scpu->rate, i2scpu->frame_bits);
+	if (i2scpu->plan.rate)
+		zxi2s_cpu_plan_show(m, &i2scpu->plan);
+	else
+		seq_puts(m, " none\n");
+	mutex_unlock(&i2scpu->lock);
+
+	for (lrdiv = 0; lrdiv < ZXI2S_CLK_LRDIV_CODES; lrdiv++) {
+		seq_printf(m, "%u bit frame:\n", frames[lrdiv]);
+		for (i = 0; i < ARRAY_SIZE(zxi2s_rates); i++) {
+			seq_printf(m, "  %6u", zxi2s_rates[i]);
+			if (i2scpu->plans[i][lrdiv].rate)
+				zxi2s_cpu_plan_show(m, &i2scpu->plans[i][lrdiv]);
+			else
+				seq_puts(m, " out of tolerance\n");
+		}
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(zxi2s_cpu_clk_plan);
+
+/*
+ * FIFO register image hw_params programs for every advertised format, "*"
+ * marks combinations the codec of the card never negotiates
+ */
+static int zxi2s_cpu_fifo_cfg_show(struct seq_file *m, void *v)
+{
+	struct snd_soc_component *component = m->private;
+	const struct snd_soc_pcm_stream *cs;
+	snd_pcm_format_t f;
+	unsigned int ch;
+
+	cs = zxi2s_codec_stream(component, SNDRV_PCM_STREAM_PLAYBACK);
+	seq_puts(m, "playback DACFIFOCFG:\n");
+	pcm_for_each_format(f) {
+		if (!(ZXI2S_PLAYBACK_FORMATS & pcm_format_to_bits(f)))
+			continue;
+		seq_printf(m, "  %-8s", snd_pcm_format_name(f));
+		for (ch = zxi2s_cpu_dai_drv.playback.channels_min;
+		     ch <= zxi2s_cpu_dai_drv.playback.channels_max; ch++)
+			seq_printf(m, " %uch=0x%02x%s", ch, zxi2s_dac_fifo_cfg(f, ch),
+				   cs && !zxi2s_codec_takes(cs, f, ch) ? "*" : "");
+		seq_puts(m, "\n");
+	}
+
+	cs = zxi2s_codec_stream(component, SNDRV_PCM_STREAM_CAPTURE);
+	seq_puts(m, "capture ADCFIFOCFG:\n");
+	pcm_for_each_format(f) {
+		if (ZXI2S_CAPTURE_FORMATS & pcm_format_to_bits(f))
+			seq_printf(m, "  %-8s 0x%02x%s\n", snd_pcm_format_name(f),
+				   zxi2s_adc_fifo_cfg(f),
+				   cs && !zxi2s_codec_takes(cs, f, 2) ? "*" : "");
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(zxi2s_cpu_fifo_cfg);
+
+/* MCLK idle gating and how long the wakes took */
+static int zxi2s_cpu_mclk_wake_show(struct seq_file *m, void *v)
+{
+	struct zxi2s_cpu *i2scpu = m->private;
+	int i;
+
+	seq_printf(m, "idle %u ms, %s, %lu gates, %lu wakes, max %llu ns\n",
+		   mclk_idle_ms, i2scpu->mclk_gated ? "gated" : "running",
+		   i2scpu->mclk_gates, i2scpu->mclk_wakes, i2scpu->mclk_wake_max_ns);
+	for (i = 0; i < ZXI2S_WAKE_BUCKETS - 1; i++)
+		seq_printf(m, "  < %6lu us: %lu\n", 1UL << i, i2scpu->mclk_wake_hist[i]);
+	seq_printf(m, "  >= %5lu us: %lu\n", 1UL << (i - 1), i2scpu->mclk_wake_hist[i]);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(zxi2s_cpu_mclk_wake);
+#endif
+
+static int zxi2s_cpu_component_probe(struct snd_soc_component *component)
+{
+#ifdef CONFIG_DEBUG_FS
+	struct zxi2s_cpu *i2scpu = snd_soc_component_get_drvdata(component);
+
+	debugfs_create_file("rates", 0444, component->debugfs_root, component,
+			    &zxi2s_cpu_rates_fops);
+	debugfs_create_file("clk_plan", 0444, component->debugfs_root, i2scpu,
+			    &zxi2s_cpu_clk_plan_fops);
+	debugfs_create_file("fifo_cfg", 0444, component->debugfs_root, component,
+			    &zxi2s_cpu_fifo_cfg_fops);
+	debugfs_create_file("mclk_wake", 0444, component->debugfs_root, i2scpu,
+			    &zxi2s_cpu_mclk_wake_fops);
+#endif
+	return 0;
+}
+
 static const struct snd_soc_component_driver zxi2s_cpu_drv = {
         .name           = ZXI2S_CPU_NAME,
+        .probe          = zxi2s_cpu_component_probe,
 #if 0
         .open           = zxi2s_cpu_open,
         .close          = zxi2s_cpu_close,
@@ -398,7 +1172,6 @@ static int zxi2s_cpu_probe(struct platform_device *pdev)
 {
 
 	int error = 0;
-	struct resource *res;
 	struct zxi2s_cpu *i2scpu;
 
 	/***************zhuang add 2021/11/17**************/
@@ -412,14 +1185,23 @@ static int zxi2s_cpu_probe(struct platform_device *pdev)
 		return -ENOMEM;
 	}
 
-	/* get mmio */
-	i2scpu->regs = devm_platform_get_and_ioremap_resource(pdev, 0, &res);
-	if (IS_ERR(i2scpu->regs)) {
-		dev_err(&pdev->dev, "get regs base failed\n");
-		return -ENOMEM;
+	/* registers are mapped once by the PCI function */
+	i2scpu->regmap = dev_get_regmap(pdev->dev.parent, NULL);
+	if (!i2scpu->regmap) {
+		dev_err(&pdev->dev, "get regmap failed\n");
+		return -ENODEV;
 	}
 
 	i2scpu->dev = &pdev->dev;
+	mutex_init(&i2scpu->lock);
+	i2scpu->tolerance = rate_tolerance;
+	zxi2s_plan_rates(i2scpu);
+
+	error = zxi2s_register_mclk(i2scpu);
+	if (error) {
+		dev_err(&pdev->dev, "register mclk failed: %d\n", error);
+		return error;
+	}
 
 	platform_set_drvdata(pdev, (void *)i2scpu);
 	dev_set_drvdata(&pdev->dev, i2scpu);
@@ -440,13 +1222,13 @@ static int zxi2s_cpu_probe(struct platform_device *pdev)
 	return 0;
 }
 
+/*
+ * i2scpu is devm memory allocated first in probe, so it is released last,
+ * after the component, the MCLK clkdev lookup and clk_hw that embed or
+ * point at it. Freeing it here would run before all of them.
+ */
 static int zxi2s_cpu_remove(struct platform_device *pdev)
 {
-	struct zxi2s_cpu *i2scpu = platform_get_drvdata(pdev);
-
-	platform_set_drvdata(pdev, NULL);
-	devm_kfree(&pdev->dev, i2scpu);
-
 	dev_info(&pdev->dev, "driver removed.\n");
 	return 0;
 }
@@ -460,7 +1242,35 @@ static struct platform_driver zxi2s_cpu_driver = {
 	},
 };
 
-module_platform_driver(zxi2s_cpu_driver);
+#ifdef ZXI2S_KUNIT_TEST
+#include "cpu_zx_i2s_test.c"
+#else
+static inline int zxi2s_cpu_test_init(void) { return 0; }
+static inline void zxi2s_cpu_test_exit(void) { }
+#endif
+
+static int __init zxi2s_cpu_module_init(void)
+{
+	int ret;
+
+	ret = zxi2s_cpu_test_init();
+	if (ret)
+		return ret;
+
+	ret = platform_driver_register(&zxi2s_cpu_driver);
+	if (ret)
+		zxi2s_cpu_test_exit();
+	return ret;
+}
+
+static void __exit zxi2s_cpu_module_exit(void)
+{
+	platform_driver_unregister(&zxi2s_cpu_driver);
+	zxi2s_cpu_test_exit();
+}
+
+module_init(zxi2s_cpu_module_init);
+module_exit(zxi2s_cpu_module_exit);
 MODULE_AUTHOR("hanshu@zhaoxin.com");
 MODULE_DESCRIPTION("ZHAOXIN I2S cpu driver");
 MODULE_VERSION(DRIVER_VERSION);
@@ -0,0 +1,407 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *      cpu_zx_i2s_test.c - KUnit checks of the shared clock holders, the
+ *      FIFO register images and the hw_rules
+ *
+ *      Copyright(c) 2021 Shanghai Zhaoxin Corporation. All rights reserved.
+ *
+ *	Built into cpu_zx_i2s.c with "make ZXI2S_KUNIT=1" (needs CONFIG_KUNIT).
+ *	Only the bookkeeping hw_params/hw_free do under i2scpu->lock is run,
+ *	there is no MCLK (the clk API takes NULL) and no register access. The
+ *	hw_rules get a substream whose rtd has a bare cpu dai, enough for
+ *	zxi2s_hw_combos() to find i2scpu.
+*/
+#include <kunit/test.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+
+#define ZXI2S_TEST_THREADS	8
+#define ZXI2S_TEST_ROUNDS	2000
+
+/* pcm device @dev, direction @dir, as zxi2s_clk_holder() numbers them */
+#define ZXI2S_TEST_HOLDER(dev, dir)	BIT((dev) * 2 + (dir))
+
+static int zxi2s_cpu_test_init_case(struct kunit *test)
+{
+	struct zxi2s_cpu *i2scpu;
+
+	i2scpu = kunit_kzalloc(test, sizeof(*i2scpu), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, i2scpu);
+	mutex_init(&i2scpu->lock);
+	test->priv = i2scpu;
+	return 0;
+}
+
+/* hw_params of one substream, minus the planner and the registers */
+static int zxi2s_test_hw_params(struct zxi2s_cpu *i2scpu, unsigned int holder,
+				int rate, int frame_bits)
+{
+	int ret;
+
+	mutex_lock(&i2scpu->lock);
+	ret = zxi2s_clk_claim(i2scpu, holder, rate, frame_bits);
+	if (!ret)
+		zxi2s_clk_hold(i2scpu, holder, rate, frame_bits);
+	mutex_unlock(&i2scpu->lock);
+	return ret;
+}
+
+static void zxi2s_test_hw_free(struct zxi2s_cpu *i2scpu, unsigned int holder)
+{
+	mutex_lock(&i2scpu->lock);
+	zxi2s_clk_release(i2scpu, holder);
+	mutex_unlock(&i2scpu->lock);
+}
+
+/* a second PCM device in the same direction must not move running clocks */
+static void zxi2s_test_holders(struct kunit *test)
+{
+	struct zxi2s_cpu *i2scpu = test->priv;
+	unsigned int pcm0p = ZXI2S_TEST_HOLDER(0, SNDRV_PCM_STREAM_PLAYBACK);
+	unsigned int pcm1p = ZXI2S_TEST_HOLDER(1, SNDRV_PCM_STREAM_PLAYBACK);
+	unsigned int pcm1c = ZXI2S_TEST_HOLDER(1, SNDRV_PCM_STREAM_CAPTURE);
+
+	KUNIT_EXPECT_EQ(test, zxi2s_test_hw_params(i2scpu, pcm0p, 48000, 64), 0);
+	/* hw_params again on the same substream may change its own clocks */
+	KUNIT_EXPECT_EQ(test, zxi2s_test_hw_params(i2scpu, pcm0p, 44100, 64), 0);
+	KUNIT_EXPECT_EQ(test, i2scpu->clk_rate, 44100);
+
+	KUNIT_EXPECT_EQ(test, zxi2s_test_hw_params(i2scpu, pcm1p, 48000, 64), -EBUSY);
+	KUNIT_EXPECT_EQ(test, zxi2s_test_hw_params(i2scpu, pcm1p, 44100, 32), -EBUSY);
+	KUNIT_EXPECT_EQ(test, zxi2s_test_hw_params(i2scpu, pcm1c, 48000, 64), -EBUSY);
+	KUNIT_EXPECT_EQ(test, i2scpu->clk_conflicts, 3UL);
+	KUNIT_EXPECT_EQ(test, i2scpu->clk_holders, pcm0p);
+
+	/* same rate and frame: joins */
+	KUNIT_EXPECT_EQ(test, zxi2s_test_hw_params(i2scpu, pcm1p, 44100, 64), 0);
+	KUNIT_EXPECT_EQ(test, i2scpu->clk_shared, 1UL);
+
+	/* the first holder leaving does not free the clocks */
+	zxi2s_test_hw_free(i2scpu, pcm0p);
+	KUNIT_EXPECT_EQ(test, zxi2s_test_hw_params(i2scpu, pcm1c, 48000, 64), -EBUSY);
+	zxi2s_test_hw_free(i2scpu, pcm1p);
+	KUNIT_EXPECT_EQ(test, i2scpu->clk_holders, 0U);
+	KUNIT_EXPECT_EQ(test, zxi2s_test_hw_params(i2scpu, pcm1c, 48000, 64), 0);
+
+	/* hw_free without hw_params, as after a failed hw_params */
+	zxi2s_test_hw_free(i2scpu, pcm0p);
+	KUNIT_EXPECT_EQ(test, i2scpu->clk_holders, pcm1c);
+	zxi2s_test_hw_free(i2scpu, pcm1c);
+}
+
+struct zxi2s_test_thread {
+	struct zxi2s_cpu *i2scpu;
+	unsigned int holder;
+	unsigned int id;
+	atomic_t *violations;
+	unsigned long held;
+	struct completion done;
+};
+
+/*
+ * one substream cycling hw_params/hw_free at two rates and two frames while
+ * the others do the same. Whenever it holds the clocks they have to stay at
+ * what it asked for until its hw_free.
+ */
+static int zxi2s_test_thread_fn(void *data)
+{
+	static const int rates[] = { 48000, 44100 };
+	static const int frames[] = { 64, 32 };
+	struct zxi2s_test_thread *t = data;
+	struct zxi2s_cpu *i2scpu = t->i2scpu;
+	int i, j, rate, frame_bits;
+
+	for (i = 0; i < ZXI2S_TEST_ROUNDS; i++) {
+		rate = rates[(i / 7 + t->id) % ARRAY_SIZE(rates)];
+		frame_bits = frames[(i / 13) % ARRAY_SIZE(frames)];
+		if (zxi2s_test_hw_params(i2scpu, t->holder, rate, frame_bits)) {
+			cond_resched();
+			continue;
+		}
+		t->held++;
+		for (j = 0; j < 4; j++) {
+			mutex_lock(&i2scpu->lock);
+			if (!(i2scpu->clk_holders & t->holder) ||
+			    i2scpu->clk_rate != rate ||
+			    i2scpu->clk_frame_bits != frame_bits)
+				atomic_inc(t->violations);
+			mutex_unlock(&i2scpu->lock);
+			cond_resched();
+		}
+		zxi2s_test_hw_free(i2scpu, t->holder);
+	}
+	complete(&t->done);
+	return 0;
+}
+
+static void zxi2s_test_holders_stress(struct kunit *test)
+{
+	struct zxi2s_cpu *i2scpu = test->priv;
+	struct zxi2s_test_thread *threads;
+	struct task_struct *task;
+	atomic_t violations = ATOMIC_INIT(0);
+	unsigned long held = 0;
+	int i;
+
+	threads = kunit_kcalloc(test, ZXI2S_TEST_THREADS, sizeof(*threads), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, threads);
+
+	/* four PCM devices, both directions each */
+	for (i = 0; i < ZXI2S_TEST_THREADS; i++) {
+		threads[i].i2scpu = i2scpu;
+		threads[i].holder = ZXI2S_TEST_HOLDER(i / 2, i % 2);
+		threads[i].id = i;
+		threads[i].violations = &violations;
+		init_completion(&threads[i].done);
+		task = kthread_run(zxi2s_test_thread_fn, &threads[i], "zxi2s-test/%d", i);
+		if (IS_ERR(task))
+			complete(&threads[i].done);
+		KUNIT_EXPECT_FALSE(test, IS_ERR(task));
+	}
+	for (i = 0; i < ZXI2S_TEST_THREADS; i++)
+		wait_for_completion(&threads[i].done);
+
+	KUNIT_EXPECT_EQ(test, atomic_read(&violations), 0);
+	KUNIT_EXPECT_EQ(test, i2scpu->clk_holders, 0U);
+	for (i = 0; i < ZXI2S_TEST_THREADS; i++)
+		held += threads[i].held;
+	KUNIT_EXPECT_GT(test, held, 0UL);
+	kunit_info(test, "%lu holds, %lu shared, %lu conflicts\n",
+		   held, i2scpu->clk_shared, i2scpu->clk_conflicts);
+}
+
+/*
+ * DACFIFOCFG/ADCFIFOCFG of every format the DAI advertises, written out by
+ * hand from the register description rather than derived from the format
+ * helpers the driver uses. dac: without CHN_NUM, adc: -1 not a capture format.
+ */
+static const struct {
+	snd_pcm_format_t format;
+	u8 dac;
+	int adc;
+} zxi2s_test_fifo_cfgs[] = {
+	{ SNDRV_PCM_FORMAT_S8,		0x00, -1 },
+	{ SNDRV_PCM_FORMAT_U8,		0x40, -1 },	/* sign */
+	{ SNDRV_PCM_FORMAT_S16_LE,	0x10, 0x01 },	/* POP_LEN 16 */
+	{ SNDRV_PCM_FORMAT_S16_BE,	0x90, -1 },	/* endian */
+	{ SNDRV_PCM_FORMAT_U16_LE,	0x50, -1 },
+	{ SNDRV_PCM_FORMAT_U16_BE,	0xd0, -1 },
+	{ SNDRV_PCM_FORMAT_S24_LE,	0x20, 0x00 },	/* POP_LEN 32 */
+	{ SNDRV_PCM_FORMAT_S24_BE,	0xa0, -1 },
+	{ SNDRV_PCM_FORMAT_U24_LE,	0x60, -1 },
+	{ SNDRV_PCM_FORMAT_U24_BE,	0xe0, -1 },
+	{ SNDRV_PCM_FORMAT_S32_LE,	0x20, 0x00 },
+	{ SNDRV_PCM_FORMAT_S32_BE,	0xa0, -1 },
+	{ SNDRV_PCM_FORMAT_U32_LE,	0x60, -1 },
+	{ SNDRV_PCM_FORMAT_U32_BE,	0xe0, -1 },
+};
+
+static void zxi2s_test_fifo_cfg(struct kunit *test)
+{
+	u64 playback = 0, capture = 0;
+	snd_pcm_format_t f;
+	unsigned int ch;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(zxi2s_test_fifo_cfgs); i++) {
+		f = zxi2s_test_fifo_cfgs[i].format;
+		playback |= pcm_format_to_bits(f);
+		for (ch = 1; ch <= ZXI2S_CHANNELS_MAX; ch++)
+			KUNIT_EXPECT_EQ_MSG(test, (int)zxi2s_dac_fifo_cfg(f, ch),
+					    zxi2s_test_fifo_cfgs[i].dac | (ch % 4),
+					    "%s %uch", snd_pcm_format_name(f), ch);
+		if (zxi2s_test_fifo_cfgs[i].adc < 0)
+			continue;
+		capture |= pcm_format_to_bits(f);
+		KUNIT_EXPECT_EQ_MSG(test, (int)zxi2s_adc_fifo_cfg(f),
+				    zxi2s_test_fifo_cfgs[i].adc,
+				    "%s", snd_pcm_format_name(f));
+	}
+
+	/* the table covers exactly what the DAI advertises */
+	KUNIT_EXPECT_EQ(test, playback, (u64)ZXI2S_PLAYBACK_FORMATS);
+	KUNIT_EXPECT_EQ(test, capture, (u64)ZXI2S_CAPTURE_FORMATS);
+
+	/* and every advertised playback format has a lrck the link can send */
+	pcm_for_each_format(f) {
+		if (ZXI2S_PLAYBACK_FORMATS & pcm_format_to_bits(f))
+			KUNIT_EXPECT_NE_MSG(test, zxi2s_format_lrck(f), 0,
+					    "%s", snd_pcm_format_name(f));
+	}
+}
+
+struct zxi2s_test_rtd {
+	struct snd_pcm pcm;
+	struct snd_soc_pcm_runtime rtd;
+	struct snd_soc_dai *dais[1];
+	struct snd_soc_dai dai;
+	struct device dev;
+	struct snd_pcm_substream substream;
+	struct snd_pcm_hw_params params;
+};
+
+static struct snd_pcm_substream *zxi2s_test_substream(struct kunit *test,
+						      struct zxi2s_cpu *i2scpu, int stream)
+{
+	struct zxi2s_test_rtd *r;
+
+	r = kunit_kzalloc(test, sizeof(*r), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, r);
+	dev_set_drvdata(&r->dev, i2scpu);
+	r->dai.dev = &r->dev;
+	r->dais[0] = &r->dai;
+	r->rtd.dais = r->dais;
+	r->substream.pcm = &r->pcm;
+	r->substream.stream = stream;
+	r->substream.private_data = &r->rtd;
+	return &r->substream;
+}
+
+/* run the three rules once on a single rate/format/channels, true if all pass */
+static bool zxi2s_test_rules(struct snd_pcm_substream *substream,
+			     struct snd_pcm_hw_params *params,
+			     unsigned int rate, snd_pcm_format_t f, unsigned int ch)
+{
+	struct snd_pcm_hw_rule rule = { .private = substream };
+	struct snd_interval *r = hw_param_interval(params, SNDRV_PCM_HW_PARAM_RATE);
+	struct snd_interval *c = hw_param_interval(params, SNDRV_PCM_HW_PARAM_CHANNELS);
+	struct snd_mask *m = hw_param_mask(params, SNDRV_PCM_HW_PARAM_FORMAT);
+
+	memset(params, 0, sizeof(*params));
+	snd_mask_none(m);
+	snd_mask_set_format(m, f);
+	r->min = r->max = rate;
+	r->integer = 1;
+	c->min = c->max = ch;
+	c->integer = 1;
+
+	return zxi2s_hw_rule_rate(params, &rule) >= 0 &&
+	       zxi2s_hw_rule_format(params, &rule) >= 0 &&
+	       zxi2s_hw_rule_channels(params, &rule) >= 0;
+}
+
+/*
+ * every rate x format x channels the DAI advertises: the rules have to accept
+ * exactly what zxi2s_clk_plan() hits without error (tolerance 0), nothing
+ * the planner can't clock and nothing it can
+ */
+static void zxi2s_test_hw_rules(struct kunit *test)
+{
+	struct zxi2s_cpu *i2scpu = test->priv;
+	const struct snd_soc_pcm_stream *streams[] = {
+		[SNDRV_PCM_STREAM_PLAYBACK] = &zxi2s_cpu_dai_drv.playback,
+		[SNDRV_PCM_STREAM_CAPTURE] = &zxi2s_cpu_dai_drv.capture,
+	};
+	struct snd_pcm_substream *substream;
+	struct snd_pcm_hw_params *params;
+	struct zxi2s_clk_plan plan;
+	unsigned int ch, frame_bits, accepted = 0, hits_192k = 0;
+	snd_pcm_format_t f;
+	bool want;
+	int dir, i;
+
+	params = kunit_kzalloc(test, sizeof(*params), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, params);
+	i2scpu->tolerance = 0;
+	zxi2s_plan_rates(i2scpu);
+
+	for (dir = 0; dir < ARRAY_SIZE(streams); dir++) {
+		substream = zxi2s_test_substream(test, i2scpu, dir);
+		for (i = 0; i < ARRAY_SIZE(zxi2s_rates); i++) {
+			KUNIT_EXPECT_GE(test, zxi2s_rates[i], streams[dir]->rate_min);
+			KUNIT_EXPECT_LE(test, zxi2s_rates[i], streams[dir]->rate_max);
+			pcm_for_each_format(f) {
+				if (!(streams[dir]->formats & pcm_format_to_bits(f)))
+					continue;
+				for (ch = streams[dir]->channels_min;
+				     ch <= streams[dir]->channels_max; ch++) {
+					frame_bits = zxi2s_clk_frame_bits(
+						zxi2s_clk_lrck(snd_pcm_format_width(f)), ch);
+					want = !zxi2s_clk_plan(zxi2s_rates[i], frame_bits, &plan) &&
+					       plan.exact;
+					KUNIT_EXPECT_EQ_MSG(test,
+						zxi2s_test_rules(substream, params,
+								 zxi2s_rates[i], f, ch),
+						want, "%s %u Hz %s %uch, %d bit frame",
+						dir ? "capture" : "playback", zxi2s_rates[i],
+						snd_pcm_format_name(f), ch, frame_bits);
+					accepted += want;
+					if (want && zxi2s_rates[i] == 192000)
+						hits_192k++;
+				}
+			}
+		}
+	}
+
+	/* the odd ones: 192k on a 32 bit frame is exact, 5512 never is */
+	substream = zxi2s_test_substream(test, i2scpu, SNDRV_PCM_STREAM_PLAYBACK);
+	KUNIT_EXPECT_TRUE(test, zxi2s_test_rules(substream, params, 192000,
+						 SNDRV_PCM_FORMAT_S16_LE, 2));
+	KUNIT_EXPECT_FALSE(test, zxi2s_test_rules(substream, params, 5512,
+						  SNDRV_PCM_FORMAT_S16_LE, 2));
+	KUNIT_EXPECT_GT(test, hits_192k, 0U);
+	kunit_info(test, "%u combinations accepted, %u at 192 kHz\n",
+		   accepted, hits_192k);
+}
+
+/* a holder of the clocks leaves only its own rate and frame to the others */
+static void zxi2s_test_hw_rules_held(struct kunit *test)
+{
+	struct zxi2s_cpu *i2scpu = test->priv;
+	struct snd_pcm_substream *substream;
+	struct snd_pcm_hw_params *params;
+
+	params = kunit_kzalloc(test, sizeof(*params), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, params);
+	i2scpu->tolerance = 0;
+	zxi2s_plan_rates(i2scpu);
+	substream = zxi2s_test_substream(test, i2scpu, SNDRV_PCM_STREAM_CAPTURE);
+
+	KUNIT_ASSERT_EQ(test, zxi2s_test_hw_params(i2scpu,
+			ZXI2S_TEST_HOLDER(1, SNDRV_PCM_STREAM_PLAYBACK), 48000, 64), 0);
+	KUNIT_EXPECT_TRUE(test, zxi2s_test_rules(substream, params, 48000,
+						 SNDRV_PCM_FORMAT_S32_LE, 2));
+	/* 48 bit frame */
+	KUNIT_EXPECT_FALSE(test, zxi2s_test_rules(substream, params, 48000,
+						  SNDRV_PCM_FORMAT_S24_LE, 2));
+	KUNIT_EXPECT_FALSE(test, zxi2s_test_rules(substream, params, 48000,
+						  SNDRV_PCM_FORMAT_S16_LE, 2));
+	KUNIT_EXPECT_FALSE(test, zxi2s_test_rules(substream, params, 96000,
+						  SNDRV_PCM_FORMAT_S32_LE, 2));
+	zxi2s_test_hw_free(i2scpu, ZXI2S_TEST_HOLDER(1, SNDRV_PCM_STREAM_PLAYBACK));
+
+	/* released, the capture side may move the clocks again */
+	KUNIT_EXPECT_TRUE(test, zxi2s_test_rules(substream, params, 96000,
+						 SNDRV_PCM_FORMAT_S32_LE, 2));
+}
+
+static struct kunit_case zxi2s_cpu_test_cases[] = {
+	KUNIT_CASE(zxi2s_test_holders),
+	KUNIT_CASE(zxi2s_test_holders_stress),
+	KUNIT_CASE(zxi2s_test_fifo_cfg),
+	KUNIT_CASE(zxi2s_test_hw_rules),
+	KUNIT_CASE(zxi2s_test_hw_rules_held),
+	{}
+};
+
+static struct kunit_suite zxi2s_cpu_test_suite = {
+	.name		= "zxi2s-cpu",
+	.init		= zxi2s_cpu_test_init_case,
+	.test_cases	= zxi2s_cpu_test_cases,
+};
+
+static struct kunit_suite *zxi2s_cpu_test_suites[] = {
+	&zxi2s_cpu_test_suite,
+	NULL
+};
+
+/* called from module init, kunit_test_suites() would take module_init itself */
+static int zxi2s_cpu_test_init(void)
+{
+	return __kunit_test_suites_init(zxi2s_cpu_test_suites);
+}
+
+static void zxi2s_cpu_test_exit(void)
+{
+	__kunit_test_suites_exit(zxi2s_cpu_test_suites);
+}
@@ -9,26 +9,90 @@
 #include <linux/platform_device.h>
 #include <linux/pm_runtime.h>
 #include <linux/interrupt.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <uapi/linux/sched/types.h>
 #include <sound/soc.h>
 #include "zx_i2s.h"
 
+/*
+ * BDL layout: 16-byte entries in a single page. CURBUF/LVI are 8-bit, so the
+ * engine wraps to entry 0 after entry 255 (or after LVI in classic mode).
+ */
+#define ZXI2S_BDL_ENTRIES		256
+#define ZXI2S_BDL_MASK			(ZXI2S_BDL_ENTRIES - 1)
+#define ZXI2S_BDL_BYTES			(ZXI2S_BDL_ENTRIES * 16)
+#define ZXI2S_BDLE_IOC			0x01
+
+/*
+ * ring mode: number of descriptors kept queued ahead of CURBUF. Refilled on
+ * every IOC, so it has to hold at least two periods worth of descriptors.
+ */
+#define ZXI2S_RING_WINDOW		128
+
+#define ZXI2S_PERIOD_BYTES_MAX		(256 * 1024)
+#define ZXI2S_BUFFER_BYTES_MAX		(4 * 1024 * 1024)
+#define ZXI2S_POOL_BYTES_DEFAULT	(64 * 1024)
+#define ZXI2S_IRQ_INTERVAL_MAX		64
+#define ZXI2S_DIRS			2	/* SNDRV_PCM_STREAM_PLAYBACK/CAPTURE */
+
+/* frames held by the I2S serializer on top of the FIFO */
+#define ZXI2S_LINK_DELAY_FRAMES		1
+
+static bool sg_buffer = true;
+module_param(sg_buffer, bool, 0444);
+MODULE_PARM_DESC(sg_buffer, "Use scatter-gather PCM buffers (default: true)");
+
+/* indexed by PCM device number */
+#define ZXI2S_PCM_DEVS			8
+static bool wc_buffer[ZXI2S_PCM_DEVS];
+module_param_array(wc_buffer, bool, NULL, 0444);
+MODULE_PARM_DESC(wc_buffer, "Write-combined PCM buffers, per PCM device (default: false)");
+
+static bool low_latency[ZXI2S_PCM_DEVS];
+module_param_array(low_latency, bool, NULL, 0444);
+MODULE_PARM_DESC(low_latency, "Low-latency profile, per PCM device (default: false)");
+
+static int irq_prio = MAX_RT_PRIO / 2;
+module_param(irq_prio, int, 0644);
+MODULE_PARM_DESC(irq_prio, "SCHED_FIFO priority of the irq thread (1-99, default: 50)");
+
+static bool hw_drain = true;
+module_param(hw_drain, bool, 0644);
+MODULE_PARM_DESC(hw_drain, "Drain playback with OSDSTOPBUF instead of polling (default: true)");
+
+static bool xrun_stop;
+module_param(xrun_stop, bool, 0644);
+MODULE_PARM_DESC(xrun_stop, "Report FIFO xruns with snd_pcm_stop_xrun() instead of resynchronising in place (default: false)");
+
+static bool freewheel;
+module_param(freewheel, bool, 0644);
+MODULE_PARM_DESC(freewheel, "Keep the link running on silence when playback underruns (default: false)");
+
+/* DPL slots: input stream first, output stream second (8 bytes each) */
+#define ZXI2S_DPL_OFFSET(dir)		((dir) == SNDRV_PCM_STREAM_PLAYBACK ? 8 : 0)
+
 
 static const struct snd_pcm_hardware zxi2s_pcm_hardware_playback = {
 		.info			= SNDRV_PCM_INFO_MMAP |
 					  SNDRV_PCM_INFO_MMAP_VALID |
 					  SNDRV_PCM_INFO_INTERLEAVED |//数据的排列方式（左右左右左右还是左左左右右右）
 					  SNDRV_PCM_INFO_PAUSE |
+					  SNDRV_PCM_INFO_NO_PERIOD_WAKEUP |
 					  SNDRV_PCM_INFO_RESUME,
-		.formats		= SNDRV_PCM_FMTBIT_S16_LE | SNDRV_PCM_FMTBIT_S24_LE | SNDRV_PCM_FMTBIT_S32_LE,
-		.rate_min		= 8000,
-		.rate_max		= 96000,
-		.period_bytes_min	= 16 * 1024,
-		.period_bytes_max	= 1024,
+		.formats		= ZXI2S_PLAYBACK_FORMATS,
+		.rates			= SNDRV_PCM_RATE_CONTINUOUS,	/* the DMA engine does not care */
+		.rate_min		= 5512,
+		.rate_max		= 192000,
+		.period_bytes_min	= 32,		/* FIFO depth, refined in open */
+		.period_bytes_max	= ZXI2S_PERIOD_BYTES_MAX,
 		.periods_min		= 1,
-		.periods_max		= 16,
+		.periods_max		= 1024,
 		.channels_min		= 2,
-		.channels_max		= 2,
-		.buffer_bytes_max	= 64 * 1024,
+		.channels_max		= ZXI2S_CHANNELS_MAX,
+		.buffer_bytes_max	= ZXI2S_BUFFER_BYTES_MAX,
 		.fifo_size		= 32,
 	};
 
@@ -38,254 +102,674 @@ static const struct snd_pcm_hardware zxi2s_pcm_hardware_playback = {
 						  SNDRV_PCM_INFO_MMAP_VALID |
 						  SNDRV_PCM_INFO_INTERLEAVED |//数据的排列方式（左右左右左右还是左左左右右右）
 						  SNDRV_PCM_INFO_PAUSE |
+						  SNDRV_PCM_INFO_NO_PERIOD_WAKEUP |
 						  SNDRV_PCM_INFO_RESUME,
-			.formats		= SNDRV_PCM_FMTBIT_S16_LE | SNDRV_PCM_FMTBIT_S24_LE | SNDRV_PCM_FMTBIT_S32_LE,
-			.rate_min		= 8000,
-			.rate_max		= 96000,
-			.period_bytes_min	= 16 * 1024,
-			.period_bytes_max	= 1024,
+			.formats		= ZXI2S_CAPTURE_FORMATS,
+			.rates			= SNDRV_PCM_RATE_CONTINUOUS,
+			.rate_min		= 5512,
+			.rate_max		= 192000,
+			.period_bytes_min	= 32,
+			.period_bytes_max	= ZXI2S_PERIOD_BYTES_MAX,
 			.periods_min		= 1,
-			.periods_max		= 16,
+			.periods_max		= 1024,
 			.channels_min		= 2,
 			.channels_max		= 2,
-			.buffer_bytes_max	= 64 * 1024,
+			.buffer_bytes_max	= ZXI2S_BUFFER_BYTES_MAX,
 			.fifo_size		= 32,
 		};
 
 
+/* software copy of what a BDL entry describes, used for position lookup */
+struct zxi2s_bdl_slot {
+	u32 ofs;	/* offset of the chunk in the PCM buffer */
+	u32 size;	/* chunk size in bytes */
+	u32 lpos;	/* offset of the chunk in the current BDL lap (DPL value) */
+	bool silence;	/* freewheel padding, points at the silence page */
+};
+
+/*
+ * one per direction, indexed by SNDRV_PCM_STREAM_*. Allocated from whole
+ * pages at probe so that each really starts on its own cacheline (a devm
+ * allocation has a header in front), the fields the irq thread and the
+ * pointer callback touch come first.
+ */
+struct zxi2s_stream_data { 
+
+		/* hot: irq thread / pointer */
+		__le32 *posbuf;		/* position buffer pointer */
+		struct snd_pcm_substream *substream;	/* assigned substream,set in PCM open*/
+		struct regmap *regmap;
+		bool running;
+		bool ring;		/* ring mode: the BDL is a window refilled from the irq handler */
+		bool period_wakeup;	/* false: no IOC at period ends (NO_PERIOD_WAKEUP) */
+		bool wc;		/* buffer mapped write-combined (wc_buffer) */
+		bool draining;		/* hardware drain armed (DRAIN trigger) */
+		bool low_latency;	/* periods reported from the hard irq */
+		bool freewheel;		/* ring queues silence past appl_ptr */
+		bool fw_pad;		/* silence queued from fw_first on */
+		unsigned int bufsize;	/* size of the play buffer in bytes */
+		unsigned int period_bytes; /* size of the period in bytes */
+		unsigned int frags;	/* number for period in the play buffer */
+		unsigned int lvi;	/* last valid index programmed to the engine */
+		unsigned int fill_ofs;	/* ring mode: next buffer offset to queue */
+		unsigned int pos_slot;	/* slot of the last pointer lookup */
+		unsigned int irq_interval;	/* IOC every N periods, clamped to the buffer */
+		unsigned long irqs;	/* IOC interrupts taken */
+
+		/* pcm support */
+
+		int direction;		/* playback / capture (SNDRV_PCM_STREAM_*) */
+		unsigned int irq_interval_req;	/* IOC every N periods, set by the mixer */
+		struct snd_dma_buffer *bdl; /* BDL buffer */
+
+		/* PCM buffer kept across hw_params/hw_free, only ever grows */
+		struct snd_dma_buffer pool;
+		int pool_type;		/* type asked for; SG allocations rewrite pool.dev.type */
+		unsigned long pool_hits;
+		unsigned long pool_misses;
+
+		unsigned int fifo_bytes;	/* FIFO depth read at probe */
+		snd_pcm_sframes_t delay;	/* last reported delay */
+
+		/* statistics */
+		unsigned int nr_desc;	/* descriptors describing one buffer pass */
+		unsigned int period_desc;	/* ring mode: most descriptors of one period */
+		u64 alloc_ns;		/* time spent allocating the last buffer */
+		unsigned long elapsed;	/* snd_pcm_period_elapsed() calls */
+		u64 elapsed_ns_total;	/* hard irq entry to snd_pcm_period_elapsed() */
+		u64 elapsed_ns_max;
+		unsigned long xruns;	/* OSDINTS/ISDINTS_XRUN seen while running */
+		unsigned long xruns_stopped;	/* of those, handed to snd_pcm_stop_xrun() */
+		u64 xrun_lost_frames;	/* link frames without data, lower bound */
+		ktime_t xrun_last;	/* last in-place resync */
+		u64 xrun_ns_last;	/* hard irq entry to resynced or stopped */
+		u64 xrun_ns_max;
+
+		/* freewheel */
+		struct snd_dma_buffer *silence;	/* one page, playback only */
+		unsigned int fw_first;	/* frags value of the first padding entry */
+		snd_pcm_uframes_t fill_frames;	/* appl_ptr domain position of fill_ofs */
+		bool fw_silent;		/* the engine is playing padding */
+		ktime_t fw_start;
+		unsigned long fw_underruns;
+		u64 fw_gap_ns;		/* last silent stretch, underrun to splice */
+
+		/* drain: OSDSTOPBUF descriptor, -1 while a ring has not queued it */
+		int drain_idx;
+		unsigned int drain_ofs;	/* buffer offset right after the last byte written */
+		unsigned int drain_fifo_us;	/* time the SRAM needs to run out on the link */
+		ktime_t drain_start;
+		ktime_t drain_irq;	/* last IOC taken while draining */
+		unsigned int drain_wakeups;
+		unsigned long drains;
+		unsigned int last_drain_wakeups;
+		u64 last_drain_ns;	/* drain start to stop */
+		u64 last_tail_ns;	/* final IOC to stop */
+
+		/* MMIO traffic of one trigger, cpu dai and dma together */
+		unsigned long triggers;
+		unsigned long trigger_reads;
+		unsigned long trigger_writes;
+		unsigned int last_trigger_reads;
+		unsigned int last_trigger_writes;
+		u64 start_ns_last;	/* START trigger entry to return */
+		u64 start_ns_max;
+
+		struct zxi2s_bdl_slot slot[ZXI2S_BDL_ENTRIES];
+
+} ____cacheline_aligned;
+
 struct zxi2s_dma {
 
 	/* controller resources information */    
 	struct device    *dev;
-	void __iomem *regs;
-	u8 irq;
+	struct regmap *regmap;		/* owned by the PCI function */
+	struct zxi2s_pdata *pdata;	/* MMIO counters of that regmap */
+	int irq;
 
-	struct zxi2s_stream_data *stream_data;
-		/* hdac_stream linked list */
-	struct list_head stream_list;
-	
-	struct snd_dma_buffer posbuf;		/* position buffer pointer */
-
-	spinlock_t zxi2s_reg_lock;
-};
+	struct zxi2s_stream_data *streams;	/* [ZXI2S_DIRS] */
 
+	/*
+	 * position buffer. The engine writes the two DPL slots 8 bytes apart
+	 * from a single DPLBASE, so they cannot be split further; the CPU only
+	 * ever reads them.
+	 */
+	struct snd_dma_buffer *posbuf;
 
+	/* latched by the hard irq handler, consumed by the irq thread */
+	u8 int_sts[2];				/* OSDINTS/ISDINTS per SNDRV_PCM_STREAM_* */
+	ktime_t irq_stamp;
+	int thread_prio;
 
-struct zxi2s_stream_data { 
+	/* soc_pcm_trigger(), wrapped to let SNDRV_PCM_TRIGGER_DRAIN through */
+	int (*soc_trigger)(struct snd_pcm_substream *substream, int cmd);
 
-		/* pcm support */
+	/* hard irq residency */
+	unsigned long hard_irqs;
+	u64 hard_ns_total;
+	u64 hard_ns_max;
 
-		int direction;		/* playback / capture (SNDRV_PCM_STREAM_*) */
-
-		unsigned int bufsize;	/* size of the play buffer in bytes */
-		unsigned int period_bytes; /* size of the period in bytes */
-		unsigned int frags;	/* number for period in the play buffer */
-		//unsigned int fifo_size;	/* FIFO size */
-		unsigned int format_val;
+	spinlock_t zxi2s_reg_lock;
+};
 
-		u32 sd_int_sta_mask;	/* stream int status mask */
+/*
+ * write BDL entry @idx and record it in the slot table
+ */
+static void zxi2s_bdl_write(struct zxi2s_stream_data *priv_data,
+			    unsigned int idx, dma_addr_t addr,
+			    unsigned int ofs, unsigned int size, bool ioc)
+{
+	__le32 *bdl = (__le32 *)priv_data->bdl->area + idx * 4;
+	struct zxi2s_bdl_slot *slot = &priv_data->slot[idx];
+
+	/* program the address field of the BDL entry */
+	bdl[0] = cpu_to_le32((u32)addr);
+	bdl[1] = cpu_to_le32(upper_32_bits(addr));
+	/* program the size field of the BDL entry */
+	bdl[2] = cpu_to_le32(size);
+	/* program the IOC to enable interrupt */
+	bdl[3] = ioc ? cpu_to_le32(ZXI2S_BDLE_IOC) : 0;
+
+	slot->ofs = ofs;
+	slot->size = size;
+	slot->silence = false;
+	/* the DPL restarts from 0 whenever the engine wraps to entry 0 */
+	slot->lpos = idx ? priv_data->slot[idx - 1].lpos +
+			   priv_data->slot[idx - 1].size : 0;
+}
 
-		void __iomem *regs;
-		struct snd_pcm_substream *substream;	/* assigned substream,set in PCM open*/
-		struct snd_dma_buffer bdl; /* BDL buffer */
-		__le32 *posbuf;		/* position buffer pointer */
+/*
+ * size of the physically contiguous run at @ofs, at most @size bytes.
+ * snd_sgbuf_get_chunk_size() stops at allocation boundaries, so keep
+ * merging while the next chunk starts right where this one ends.
+ */
+static unsigned int zxi2s_sg_chunk(struct snd_dma_buffer *dmab,
+				   unsigned int ofs, unsigned int size)
+{
+	dma_addr_t addr = snd_sgbuf_get_addr(dmab, ofs);
+	unsigned int chunk = snd_sgbuf_get_chunk_size(dmab, ofs, size);
+
+	while (chunk < size &&
+	       snd_sgbuf_get_addr(dmab, ofs + chunk) == addr + chunk)
+		chunk += snd_sgbuf_get_chunk_size(dmab, ofs + chunk,
+						  size - chunk);
+	return chunk;
+}
 
-		struct list_head list;	
-		bool running;
+/*
+ * whether the descriptor ending at buffer offset @end raises IOC: only
+ * period ends, and of those only every irq_interval-th one
+ */
+static bool zxi2s_want_ioc(struct zxi2s_stream_data *priv_data, unsigned int end)
+{
+	if (end % priv_data->period_bytes)
+		return false;
+	return !((end / priv_data->period_bytes) % priv_data->irq_interval);
+}
 
-};
+static void zxi2s_update_irq_interval(struct zxi2s_stream_data *priv_data)
+{
+	unsigned int periods = priv_data->period_bytes ?
+			       priv_data->bufsize / priv_data->period_bytes : 0;
+
+	unsigned int max_interval = max(periods / 2, 1U);
+
+	/*
+	 * a ring is only refilled on IOC: keep at most half a window between
+	 * two of them, or the engine reaches LVI and replays stale entries
+	 */
+	if (priv_data->ring && priv_data->period_desc)
+		max_interval = min(max_interval,
+				   max(ZXI2S_RING_WINDOW / 2 / priv_data->period_desc, 1U));
+
+	/* keep at least two interrupts per buffer */
+	priv_data->irq_interval = clamp(priv_data->irq_interval_req, 1U,
+					max_interval);
+}
 
 /*
  * set up a BDL entry
  */
 static int setup_bdle(
 		      struct snd_dma_buffer *dmab,
-		      struct zxi2s_stream_data *priv_data, __le32 **bdlp,
+		      struct zxi2s_stream_data *priv_data,
 		      int ofs, int size, int with_ioc)
 {
-	__le32 *bdl = *bdlp;
-
 	while (size > 0) {
-		dma_addr_t addr;
 		int chunk;
 
-		if (priv_data->frags >= 256)
+		if (priv_data->frags >= ZXI2S_BDL_ENTRIES)
 			return -EINVAL;
 
-		addr = snd_sgbuf_get_addr(dmab, ofs);
-		/* program the address field of the BDL entry */
-		bdl[0] = cpu_to_le32((u32)addr);
-		bdl[1] = cpu_to_le32(upper_32_bits(addr));
-		/* program the size field of the BDL entry */
-		chunk = snd_sgbuf_get_chunk_size(dmab, ofs, size);
-		
-		bdl[2] = cpu_to_le32(chunk);
+		chunk = zxi2s_sg_chunk(dmab, ofs, size);
+		size -= chunk;
 		/* program the IOC to enable interrupt
 		 * only when the whole fragment is processed
 		 */
-		size -= chunk;
-		bdl[3] = (size || !with_ioc) ? 0 : cpu_to_le32(0x01);
-		bdl += 4;
+		zxi2s_bdl_write(priv_data, priv_data->frags,
+				snd_sgbuf_get_addr(dmab, ofs), ofs, chunk,
+				!size && with_ioc &&
+				zxi2s_want_ioc(priv_data, ofs + chunk));
 		priv_data->frags++;
 		ofs += chunk;
 	}
-	*bdlp = bdl;
 	return ofs;
 }
 
-/**
- * snd_hdac_stream_setup_periods - set up BDL entries
- * @azx_dev: HD-audio core stream to set up
- *
- * Set up the buffer descriptor table of the given stream based on the
- * period and buffer sizes of the assigned PCM substream.
+/* freewheel: bytes the application has written beyond fill_ofs */
+static unsigned int zxi2s_fw_avail(struct zxi2s_stream_data *priv_data)
+{
+	struct snd_pcm_runtime *runtime = priv_data->substream->runtime;
+	snd_pcm_sframes_t avail;
+
+	/* appl_ptr moves under the application, not under zxi2s_reg_lock */
+	avail = READ_ONCE(runtime->control->appl_ptr) - priv_data->fill_frames;
+	if (avail < 0)
+		avail += runtime->boundary;
+	return frames_to_bytes(runtime, avail);
+}
+
+/*
+ * freewheel: queue a silence page instead of data. fill_ofs stays where it
+ * is, the pointer callback holds just before it until data is spliced in.
  */
-int snd_i2s_stream_setup_periods(struct zxi2s_stream_data *priv_data)
+static void zxi2s_fw_queue_silence(struct zxi2s_stream_data *priv_data)
 {
-	
-	struct snd_pcm_substream *substream = priv_data->substream;
-	struct snd_pcm_runtime *runtime = substream->runtime;
-	__le32 *bdl;
-	int i, ofs, periods, period_bytes;
+	struct snd_pcm_runtime *runtime = priv_data->substream->runtime;
+	unsigned int idx = priv_data->frags & ZXI2S_BDL_MASK;
+	unsigned int size = rounddown(min_t(unsigned int, priv_data->period_bytes,
+					    PAGE_SIZE), frames_to_bytes(runtime, 1));
+
+	if (!priv_data->fw_pad) {
+		priv_data->fw_pad = true;
+		priv_data->fw_first = priv_data->frags;
+	}
+	/* IOC on every page so the splice is checked as often */
+	zxi2s_bdl_write(priv_data, idx, priv_data->silence->addr,
+			priv_data->fill_ofs, size, true);
+	priv_data->slot[idx].silence = true;
+	priv_data->frags++;
+}
 
+/*
+ * ring mode: queue the next chunk of the PCM buffer behind LVI. A chunk never
+ * crosses a period boundary so that IOC lands exactly on the period end.
+ * Without period wakeups the ring still needs refilling, so IOC is then only
+ * set twice per window.
+ */
+static void zxi2s_ring_queue(struct zxi2s_stream_data *priv_data)
+{
+	struct snd_dma_buffer *dmab = snd_pcm_get_dma_buf(priv_data->substream);
+	unsigned int ofs = priv_data->fill_ofs;
+	unsigned int end = rounddown(ofs, priv_data->period_bytes) +
+			   priv_data->period_bytes;
+	unsigned int chunk, avail;
+	bool ioc;
+
+	if (priv_data->freewheel) {
+		/* padding stays contiguous until the next splice */
+		avail = priv_data->fw_pad ? 0 : zxi2s_fw_avail(priv_data);
+		if (!avail) {
+			zxi2s_fw_queue_silence(priv_data);
+			return;
+		}
+		end = min(end, ofs + avail);
+	}
 
-	period_bytes = priv_data->period_bytes;
-	periods = priv_data->bufsize / period_bytes;
+	chunk = zxi2s_sg_chunk(dmab, ofs, end - ofs);
+	if (priv_data->period_wakeup)
+		ioc = ofs + chunk == end && zxi2s_want_ioc(priv_data, end);
+	else
+		ioc = !(priv_data->frags % (ZXI2S_RING_WINDOW / 2));
+	zxi2s_bdl_write(priv_data, priv_data->frags & ZXI2S_BDL_MASK,
+			snd_sgbuf_get_addr(dmab, ofs), ofs, chunk, ioc);
+	priv_data->frags++;
+
+	if (priv_data->freewheel) {
+		struct snd_pcm_runtime *runtime = priv_data->substream->runtime;
+
+		priv_data->fill_frames += bytes_to_frames(runtime, chunk);
+		if (priv_data->fill_frames >= runtime->boundary)
+			priv_data->fill_frames -= runtime->boundary;
+	}
 
-	/* program the initial BDL entries */
-	bdl = (__le32 *)priv_data->bdl.area;//虚拟地址
-	ofs = 0;
-	priv_data->frags = 0;
+	ofs += chunk;
+	priv_data->fill_ofs = ofs < priv_data->bufsize ? ofs : 0;
+}
 
+static void zxi2s_ring_set_lvi(struct zxi2s_stream_data *priv_data)
+{
+	priv_data->lvi = (priv_data->frags - 1) & ZXI2S_BDL_MASK;
 
-	for (i = 0; i < periods; i++) {
-		ofs = setup_bdle(snd_pcm_get_dma_buf(substream),priv_data, &bdl, ofs,period_bytes, 1);
+	if (priv_data->direction == SNDRV_PCM_STREAM_PLAYBACK)
+		zxi2s_reg_writeb(priv_data, ZXI2S_REG_OSDLVI, priv_data->lvi);
+	else
+		zxi2s_reg_writeb(priv_data, ZXI2S_REG_ISDLVI, priv_data->lvi);
+}
 
-		if (ofs < 0)
-			goto error;
+/* first queued descriptor from @cur on that holds the last byte to drain */
+static int zxi2s_drain_find(struct zxi2s_stream_data *priv_data, unsigned int cur)
+{
+	unsigned int n, i, idx;
+	struct zxi2s_bdl_slot *slot;
+
+	n = priv_data->ring ? (priv_data->frags - cur) & ZXI2S_BDL_MASK :
+			      priv_data->lvi + 1;
+	for (i = 0; i < n; i++) {
+		idx = priv_data->ring ? (cur + i) & ZXI2S_BDL_MASK :
+					(cur + i) % (priv_data->lvi + 1);
+		slot = &priv_data->slot[idx];
+		if (priv_data->drain_ofs > slot->ofs &&
+		    priv_data->drain_ofs <= slot->ofs + slot->size)
+			return idx;
+	}
+	return -1;
+}
+
+/*
+ * hardware drain: let the engine stop by itself after the descriptor holding
+ * the last byte the application wrote, with COMSET_STOP_DAC_BUF the SRAM
+ * still runs out on the link. That descriptor is the only one left with IOC.
+ * Called with zxi2s_reg_lock held.
+ */
+static void zxi2s_drain_arm(struct zxi2s_stream_data *priv_data)
+{
+	unsigned int cur = zxi2s_reg_readb(priv_data, ZXI2S_REG_OSDCURBUF);
+	__le32 *bdl = (__le32 *)priv_data->bdl->area;
+	struct zxi2s_bdl_slot *slot;
+	unsigned int i;
+	int idx;
+
+	idx = zxi2s_drain_find(priv_data, cur);
+	if (idx < 0)
+		return;		/* ring: retried on the next refill */
+
+	/*
+	 * not fetched yet: cut off what the application never wrote. The one
+	 * being fetched keeps its length, silence its tail instead; what the
+	 * engine already read of it plays stale, nothing can be done there.
+	 */
+	slot = &priv_data->slot[idx];
+	if (idx != cur) {
+		slot->size = priv_data->drain_ofs - slot->ofs;
+		bdl[idx * 4 + 2] = cpu_to_le32(slot->size);
+	} else if (!slot->silence && slot->ofs + slot->size > priv_data->drain_ofs) {
+		struct snd_pcm_runtime *runtime = priv_data->substream->runtime;
+
+		snd_pcm_format_set_silence(runtime->format,
+				runtime->dma_area + priv_data->drain_ofs,
+				bytes_to_samples(runtime, slot->ofs + slot->size -
+						 priv_data->drain_ofs));
 	}
-	return 0;
 
- error:
-	printk("Too many BDL entries: buffer=%d, period=%d\n",
-		priv_data->bufsize, period_bytes);
-	return -EINVAL;
+	for (i = 0; i < ZXI2S_BDL_ENTRIES; i++)
+		bdl[i * 4 + 3] = i == idx ? cpu_to_le32(ZXI2S_BDLE_IOC) : 0;
+
+	/* LVI also bounds the slot lookup of the pointer callback */
+	priv_data->lvi = idx;
+	priv_data->drain_idx = idx;
+	zxi2s_reg_writeb(priv_data, ZXI2S_REG_OSDLVI, idx);
+	zxi2s_reg_writeb(priv_data, ZXI2S_REG_OSDSTOPBUF, idx);
+	zxi2s_reg_updateb(priv_data, ZXI2S_REG_COMSET, COMSET_STOP_DAC_BUF,
+			  COMSET_STOP_DAC_BUF);
 }
 
-void zxi2s_dma_start(struct zxi2s_stream_data *priv_data)
+/* buffer offset at which the engine halts on the stop descriptor */
+static unsigned int zxi2s_drain_end(struct zxi2s_stream_data *priv_data)
 {
-	
-	if(priv_data->direction){
+	struct zxi2s_bdl_slot *slot = &priv_data->slot[priv_data->drain_idx];
+	unsigned int end = slot->ofs + slot->size;
 
-	priv_data->running = true;
-			
-	/* start a transfer---output*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_MODRST, ZXI2S_REG_MODRST & (~MODRST_DAC));
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_MODRST, ZXI2S_REG_MODRST | MODRST_DAC);
+	return end < priv_data->bufsize ? end : end - priv_data->bufsize;
+}
+
+static unsigned int zxi2s_cur_buf(struct zxi2s_stream_data *priv_data)
+{
+	if (priv_data->direction == SNDRV_PCM_STREAM_PLAYBACK)
+		return zxi2s_reg_readb(priv_data, ZXI2S_REG_OSDCURBUF);
+	return zxi2s_reg_readb(priv_data, ZXI2S_REG_ISDCURBUF);
+}
+
+/*
+ * freewheel: once the application has written again, drop the padding the
+ * engine has not fetched yet (cur and cur + 1 may be in flight) so that the
+ * refill queues the new data right behind. Called with zxi2s_reg_lock held.
+ */
+static void zxi2s_fw_splice(struct zxi2s_stream_data *priv_data, unsigned int cur)
+{
+	unsigned int queued = (priv_data->frags - cur) & ZXI2S_BDL_MASK;
+	unsigned int first = (priv_data->fw_first - cur) & ZXI2S_BDL_MASK;
 
-	/* Output Stream DMA Stop Buffer Function Control*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_COMSET, ZXI2S_REG_COMSET & (~COMSET_STOP_DAC_BUF));
+	if (priv_data->slot[cur].silence && !priv_data->fw_silent) {
+		priv_data->fw_silent = true;
+		priv_data->fw_start = ktime_get();
+		priv_data->fw_underruns++;
+	}
 
-	/*no exchange little/big endian in FIFO*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_DACFIFOCFG, ZXI2S_REG_DACFIFOCFG & (~DACFIFOCFG_ENDIAN_EXCHANGE));
+	if (!priv_data->fw_pad || !zxi2s_fw_avail(priv_data))
+		return;
+
+	/* the engine is already inside the padding */
+	if (first >= queued)
+		first = 0;
+	first = max(first, 2U);
+	if (first >= queued)
+		return;
+
+	priv_data->frags -= queued - first;
+	priv_data->fw_pad = false;
+	if (priv_data->fw_silent) {
+		priv_data->fw_silent = false;
+		priv_data->fw_gap_ns = ktime_to_ns(ktime_sub(ktime_get(),
+							     priv_data->fw_start));
+	}
+}
 
-	/*no exchange unsigned/signed format*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_DACFIFOCFG, ZXI2S_REG_DACFIFOCFG & (~DACFIFOCFG_SIGN_EXCHANGE));
+/*
+ * ring mode: top the window up again behind the entry the engine is on and
+ * advance LVI. Called from the irq handler with zxi2s_reg_lock held.
+ */
+static void zxi2s_ring_refill(struct zxi2s_stream_data *priv_data)
+{
+	unsigned int cur;
 
-	/*sample quantization=32*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_DACFIFOCFG,ZXI2S_REG_DACFIFOCFG |(DACFIFOCFG_POP_LEN & 0X10 ));
+	/* nothing beyond the stop descriptor */
+	if (priv_data->draining && priv_data->drain_idx >= 0)
+		return;
 
-	/*2 CHANNEL*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_DACFIFOCFG,ZXI2S_REG_DACFIFOCFG | (DACFIFOCFG_CHN_NUM & 0X10 ));
+	cur = zxi2s_cur_buf(priv_data);
+	if (priv_data->freewheel)
+		zxi2s_fw_splice(priv_data, cur);
 
+	/* frags is free running, cur is 8-bit: compare modulo the BDL size */
+	if (((priv_data->frags - cur) & ZXI2S_BDL_MASK) >= ZXI2S_RING_WINDOW)
+		return;
 
-	/*I2S output data/WS change on negative edge of serial clock*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_DACIFCFG,ZXI2S_REG_DACIFCFG & (~DACIFCFG_POSTIVE_EDGE ));
+	while (((priv_data->frags - cur) & ZXI2S_BDL_MASK) < ZXI2S_RING_WINDOW)
+		zxi2s_ring_queue(priv_data);
 
-	/*output data left/right channel transmitted on low-level of WS*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_DACIFCFG,ZXI2S_REG_DACIFCFG & (~DACIFCFG_POSTIVE_EDGE ));
+	zxi2s_ring_set_lvi(priv_data);
+	if (priv_data->draining)
+		zxi2s_drain_arm(priv_data);
+}
 
-	/*mclk/bclk/ws setting on cpu_dai hwparams func*/
+/*
+ * translate the DPL value into a buffer offset using the slot table.
+ * Called with zxi2s_reg_lock held.
+ */
+static unsigned int zxi2s_stream_pos(struct zxi2s_stream_data *priv_data)
+{
+	u32 dpl = le32_to_cpu(READ_ONCE(*priv_data->posbuf));
+	unsigned int idx = priv_data->pos_slot;
+	struct zxi2s_bdl_slot *slot;
+	unsigned int pos;
 
-	/*padding=8BITS*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_DACIFCFG,ZXI2S_REG_DACIFCFG | (DACIFCFG_SDPAD & 0X1000));
+	/* engine wrapped to entry 0 since the last lookup */
+	if (dpl < priv_data->slot[idx].lpos)
+		idx = 0;
 
-	/* start output transfer*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_DACIFCFG,ZXI2S_REG_DACIFCFG |DACIFCFG_START);
+	for (;;) {
+		slot = &priv_data->slot[idx];
+		if (dpl < slot->lpos + slot->size || idx == priv_data->lvi ||
+		    idx == ZXI2S_BDL_MASK)
+			break;
+		idx = (idx + 1) & ZXI2S_BDL_MASK;
 	}
+	priv_data->pos_slot = idx;
+
+	/*
+	 * padding: hold one frame short of the underrun point, the core would
+	 * otherwise see an empty buffer and stop the stream
+	 */
+	if (slot->silence)
+		return (slot->ofs ? slot->ofs : priv_data->bufsize) -
+		       frames_to_bytes(priv_data->substream->runtime, 1);
+
+	pos = slot->ofs + min(dpl - slot->lpos, slot->size);
+	return pos < priv_data->bufsize ? pos : pos - priv_data->bufsize;
+}
 
-	else{
+/**
+ * snd_i2s_stream_setup_periods - set up BDL entries
+ * @priv_data: I2S stream to set up
+ *
+ * Set up the buffer descriptor table of the given stream based on the
+ * period and buffer sizes of the assigned PCM substream. Buffers that
+ * need more than ZXI2S_BDL_ENTRIES descriptors run in ring mode.
+ */
+int snd_i2s_stream_setup_periods(struct zxi2s_stream_data *priv_data)
+{
 	
-	priv_data->running = true;
-	/* start a transfer---input*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_MODRST, ZXI2S_REG_MODRST & (~MODRST_ADC));
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_MODRST,  ZXI2S_REG_MODRST | MODRST_ADC);
+	struct snd_pcm_substream *substream = priv_data->substream;
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct snd_dma_buffer *dmab = snd_pcm_get_dma_buf(substream);
+	int i, ofs, periods, period_bytes;
+	unsigned int n;
 
-	/*I2S input data/WS change on negative edge of serial clock*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_DACIFCFG,ZXI2S_REG_DACIFCFG & (~DACIFCFG_POSTIVE_EDGE ));
 
-	/*I2S input data/WS change on negative edge of serial clock*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_ADCIFCFG, ZXI2S_REG_ADCIFCFG | ADCIFCFG_NEGATIVE_EDGE );
+	period_bytes = priv_data->period_bytes;
+	periods = priv_data->bufsize / period_bytes;
 
-	/*left/right channel data sampled on low-level/high-level of WS*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_ADCIFCFG,ZXI2S_REG_ADCIFCFG | ADCIFCFG_LEFT_IN_LOW );
+	/* program the initial BDL entries */
+	ofs = 0;
+	priv_data->frags = 0;
+	priv_data->pos_slot = 0;
+	priv_data->ring = false;
 
-	/*16-bit mode*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_ADCFIFOCFG,ZXI2S_REG_ADCFIFOCFG | ADCFIFOCFG_POP_LEN );
 
-	/* start input transfer*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_ADCFIFOCFG,ZXI2S_REG_ADCFIFOCFG | ADCFIFOCFG_START);
-	
-	}
-	
+	/*
+	 * no period wakeup: build the BDL without IOC, the DPL is the only
+	 * progress report and a classic BDL then raises no interrupt at all
+	 */
+	priv_data->period_wakeup = !runtime->no_period_wakeup;
+	zxi2s_update_irq_interval(priv_data);
 
-}
-void zxi2s_dma_stop(struct zxi2s_stream_data *priv_data)
-{
-	if(priv_data->direction){
+	/* freewheel needs the ring to decide data or silence per descriptor */
+	priv_data->freewheel = freewheel && priv_data->silence;
+	if (priv_data->freewheel)
+		snd_pcm_format_set_silence(runtime->format, priv_data->silence->area,
+					   bytes_to_samples(runtime, PAGE_SIZE));
 
-	priv_data->running = 0;
+	for (i = 0; !priv_data->freewheel && i < periods; i++) {
+		ofs = setup_bdle(dmab, priv_data, ofs, period_bytes,
+				 priv_data->period_wakeup);
 
-	/* stop output transfer*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_DACIFCFG,ZXI2S_REG_DACIFCFG & (~DACIFCFG_START));
+		if (ofs < 0)
+			break;
+	}
+	if (!priv_data->freewheel && ofs >= 0) {
+		priv_data->lvi = priv_data->frags - 1;
+		priv_data->nr_desc = priv_data->frags;
+		return 0;
+	}
 
-	/* reset output func*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_MODRST,ZXI2S_REG_MODRST | MODRST_DAC);
+	/* does not fit in the BDL: keep a window queued and refill on IOC */
+	priv_data->nr_desc = 0;
+	priv_data->period_desc = 0;
+	for (ofs = 0, n = 0; ofs < priv_data->bufsize; priv_data->nr_desc++) {
+		ofs += zxi2s_sg_chunk(dmab, ofs, period_bytes - ofs % period_bytes);
+		n++;
+		if (!(ofs % period_bytes)) {
+			priv_data->period_desc = max(priv_data->period_desc, n);
+			n = 0;
+		}
 	}
-	else{
 
-	priv_data->running = 0;
-	/* stop input transfer*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_ADCFIFOCFG,ZXI2S_REG_ADCFIFOCFG & (~ADCFIFOCFG_START));
+	priv_data->ring = true;
+	zxi2s_update_irq_interval(priv_data);
+	priv_data->frags = 0;
+	priv_data->fill_ofs = 0;
+	/* appl_ptr is only reset after this, pad until START */
+	priv_data->fill_frames = 0;
+	priv_data->fw_pad = priv_data->freewheel;
+	priv_data->fw_first = 0;
+	priv_data->fw_silent = false;
+	while (priv_data->frags < ZXI2S_RING_WINDOW)
+		zxi2s_ring_queue(priv_data);
+	priv_data->lvi = priv_data->frags - 1;
 
-	/* reset input func*/
-	zxi2s_reg_writeb(priv_data,ZXI2S_REG_MODRST, ZXI2S_REG_MODRST | MODRST_ADC);
+	return 0;
+}
 
-	}
+/*
+ * The register image (interface, FIFO, clocks) is written by cpu hw_params and
+ * dma prepare, a trigger only flips the START bit of its direction.
+ */
+void zxi2s_dma_start(struct zxi2s_stream_data *priv_data)
+{
+	priv_data->running = true;
+	if (priv_data->direction == SNDRV_PCM_STREAM_PLAYBACK)
+		zxi2s_reg_updatel(priv_data, ZXI2S_REG_DACIFCFG, DACIFCFG_START, DACIFCFG_START);
+	else
+		zxi2s_reg_updateb(priv_data, ZXI2S_REG_ADCFIFOCFG, ADCFIFOCFG_START, ADCFIFOCFG_START);
+}
+
+void zxi2s_dma_stop(struct zxi2s_stream_data *priv_data)
+{
+	priv_data->running = false;
+	if (priv_data->direction == SNDRV_PCM_STREAM_PLAYBACK)
+		zxi2s_reg_updatel(priv_data, ZXI2S_REG_DACIFCFG, DACIFCFG_START, 0);
+	else
+		zxi2s_reg_updateb(priv_data, ZXI2S_REG_ADCFIFOCFG, ADCFIFOCFG_START, 0);
+}
+
+static bool zxi2s_wc_buffer(int device)
+{
+	return device < ZXI2S_PCM_DEVS && wc_buffer[device];
+}
+
+static bool zxi2s_low_latency(int device)
+{
+	return device < ZXI2S_PCM_DEVS && low_latency[device];
+}
+
+static int zxi2s_buffer_type(bool wc)
+{
+	if (wc)
+		return sg_buffer ? SNDRV_DMA_TYPE_DEV_WC_SG : SNDRV_DMA_TYPE_DEV_WC;
+	return sg_buffer ? SNDRV_DMA_TYPE_DEV_SG : SNDRV_DMA_TYPE_DEV;
 }
 
 static int zxi2s_dma_open(struct snd_soc_component *component ,struct snd_pcm_substream *substream)
 {
-	int err,res;
-	struct zxi2s_stream_data *priv_data；
-	struct zxi2s_stream_data *res=null；
-	
 	struct snd_pcm_runtime *runtime = substream->runtime;
-	
-//	struct snd_soc_pcm_runtime *prtd = substream->private_data;
-//	component = snd_soc_rtdcom_lookup(prtd,ZXI2S_DMA_NAME);
-
 	struct zxi2s_dma *i2sdma =  dev_get_drvdata(component->dev);
-	
-	
-	list_for_each_entry(priv_data, &i2sdma->stream_list, list) {
-		if (priv_data->direction != substream->stream)
-			continue;
-		else res = priv_data；
-			break;
-		}
-
+	struct zxi2s_stream_data *res = &i2sdma->streams[substream->stream];
+
+	/*
+	 * one engine per direction shared by every PCM device of the card,
+	 * the second open of a direction must not take over the running one
+	 */
+	spin_lock_irq(&i2sdma->zxi2s_reg_lock);
+	if (res->substream) {
+		spin_unlock_irq(&i2sdma->zxi2s_reg_lock);
+		return -EBUSY;
+	}
 	res->substream = substream;// irq handler中elapsed需要从这里获取
+	spin_unlock_irq(&i2sdma->zxi2s_reg_lock);
+
+	res->wc = zxi2s_wc_buffer(substream->pcm->device);
+	res->low_latency = zxi2s_low_latency(substream->pcm->device);
 
 	//先通过参数，系统分配runtime hw的值，然后最终还是要和app传下来的值做比较，以及我自己特定的hw值，
 	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
@@ -296,11 +780,22 @@ static int zxi2s_dma_open(struct snd_soc_component *component ,struct snd_pcm_su
 		}
 
 	runtime->private_data = res;
+	runtime->hw.fifo_size = res->fifo_bytes;
+	if (hw_drain && substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+		runtime->hw.info |= SNDRV_PCM_INFO_DRAIN_TRIGGER;
+	/* a period shorter than the FIFO raises IOC before the data hit the link */
+	runtime->hw.period_bytes_min = res->fifo_bytes;
+	if (res->low_latency) {
+		/*
+		 * one FIFO worth on the link while the next is fetched. Small
+		 * periods cross at most one page, keep them in a classic BDL so
+		 * the hard irq never has to refill a ring.
+		 */
+		runtime->hw.period_bytes_min = 2 * res->fifo_bytes;
+		runtime->hw.periods_max = ZXI2S_BDL_ENTRIES / 2;
+	}
 
-
-	//enable BDL position buffer
-	zxi2s_reg_writeb(res,ZXI2S_REG_DPLBASE, ZXI2S_REG_DPLBASE | DPLBASE_EN);
-
+	/* the position buffer (DPLBASE_EN) is programmed in prepare */
 
 	snd_pcm_hw_constraint_integer(runtime, SNDRV_PCM_HW_PARAM_PERIODS);
 	return 0;
@@ -308,23 +803,82 @@ static int zxi2s_dma_open(struct snd_soc_component *component ,struct snd_pcm_su
 
 static int zxi2s_dma_close(struct snd_soc_component *component, struct snd_pcm_substream *substream)
 {
+	struct zxi2s_dma *i2sdma = dev_get_drvdata(component->dev);
+	struct zxi2s_stream_data *res = &i2sdma->streams[substream->stream];
 
 	//amd 主要在这里要关中断
 
+	/* the direction is free for the other PCM device again */
+	spin_lock_irq(&i2sdma->zxi2s_reg_lock);
+	if (res->substream == substream)
+		res->substream = NULL;
+	spin_unlock_irq(&i2sdma->zxi2s_reg_lock);
+
 	return 0;
 }
 
 
 
 
+static void zxi2s_drain_start(struct zxi2s_stream_data *priv_data)
+{
+	struct snd_pcm_runtime *runtime = priv_data->substream->runtime;
+	unsigned int ofs = frames_to_bytes(runtime,
+			runtime->control->appl_ptr % runtime->buffer_size);
+
+	priv_data->draining = true;
+	priv_data->drain_idx = -1;
+	priv_data->drain_ofs = ofs ? : priv_data->bufsize;
+	priv_data->drain_fifo_us = div_u64((u64)priv_data->fifo_bytes * USEC_PER_SEC,
+					   frames_to_bytes(runtime, runtime->rate));
+	priv_data->drain_start = ktime_get();
+	priv_data->drain_wakeups = 0;
+	zxi2s_drain_arm(priv_data);
+}
+
+/* account a finished drain, hardware or polled, and disarm STOPBUF */
+static void zxi2s_drain_done(struct zxi2s_stream_data *priv_data)
+{
+	ktime_t now = ktime_get();
+
+	if (!priv_data->drain_start)
+		return;
+
+	priv_data->drains++;
+	priv_data->last_drain_wakeups = priv_data->drain_wakeups;
+	priv_data->last_drain_ns = ktime_to_ns(ktime_sub(now, priv_data->drain_start));
+	priv_data->last_tail_ns = priv_data->drain_irq ?
+		ktime_to_ns(ktime_sub(now, priv_data->drain_irq)) : 0;
+	priv_data->drain_start = 0;
+	priv_data->drain_irq = 0;
+
+	if (priv_data->draining) {
+		priv_data->draining = false;
+		zxi2s_reg_updateb(priv_data, ZXI2S_REG_COMSET, COMSET_STOP_DAC_BUF, 0);
+	}
+}
+
 static int zxi2s_dma_trigger(struct snd_soc_component *component,struct snd_pcm_substream *substream,int cmd)
 {
-	int ret;
+	int ret = 0;
 	struct snd_pcm_runtime *runtime = substream->runtime;
 	struct zxi2s_stream_data *priv_data = runtime->private_data;
+	struct zxi2s_dma *i2sdma = dev_get_drvdata(component->dev);
+	unsigned long flags;
 
 	switch (cmd) {
 	case SNDRV_PCM_TRIGGER_START:
+		/* freewheel: requeue the window with what was written so far */
+		if (priv_data->freewheel) {
+			spin_lock_irqsave(&i2sdma->zxi2s_reg_lock, flags);
+			priv_data->frags = 0;
+			priv_data->fw_pad = false;
+			while (priv_data->frags < ZXI2S_RING_WINDOW)
+				zxi2s_ring_queue(priv_data);
+			zxi2s_ring_set_lvi(priv_data);
+			spin_unlock_irqrestore(&i2sdma->zxi2s_reg_lock, flags);
+		}
+		fallthrough;
 	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
 	case SNDRV_PCM_TRIGGER_RESUME:
 		zxi2s_dma_start(priv_data);
@@ -333,9 +887,22 @@ static int zxi2s_dma_trigger(struct snd_soc_component *component,struct snd_pcm_
 	case SNDRV_PCM_TRIGGER_STOP:
 	case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
 	case SNDRV_PCM_TRIGGER_SUSPEND:
+		spin_lock_irqsave(&i2sdma->zxi2s_reg_lock, flags);
+		zxi2s_drain_done(priv_data);
+		spin_unlock_irqrestore(&i2sdma->zxi2s_reg_lock, flags);
 		zxi2s_dma_stop(priv_data);
 		break;
 
+	case SNDRV_PCM_TRIGGER_DRAIN:
+		if (substream->stream != SNDRV_PCM_STREAM_PLAYBACK) {
+			ret = -EINVAL;
+			break;
+		}
+		spin_lock_irqsave(&i2sdma->zxi2s_reg_lock, flags);
+		zxi2s_drain_start(priv_data);
+		spin_unlock_irqrestore(&i2sdma->zxi2s_reg_lock, flags);
+		break;
+
 	default:
 		ret = -EINVAL;
 	}
@@ -345,33 +912,428 @@ static int zxi2s_dma_trigger(struct snd_soc_component *component,struct snd_pcm_
 static snd_pcm_uframes_t zxi2s_dma_pointer(struct snd_soc_component *component ,struct snd_pcm_substream *substream)
 {
 	unsigned int pos;
+	unsigned long flags;
 
 	struct snd_pcm_runtime *runtime = substream->runtime;
 	struct zxi2s_stream_data *priv_data = runtime->private_data;
+	struct zxi2s_dma *i2sdma = dev_get_drvdata(component->dev);
 
 	/* use the position buffer 
 	在snd_hdac_bus_alloc_stream_pages()函数里面，在分配完posbuf后，
 	将area赋值给了stream的le32* posbuf,这里就直接用，因为就一个stream
+	The DPL counts from BDL entry 0, map it back through the slot table
+	so that ring mode (where entries are rewritten) reports correctly.
 	*/
-	pos = (__le32 *)(priv_data->posbuf.area);
+	spin_lock_irqsave(&i2sdma->zxi2s_reg_lock, flags);
+	pos = zxi2s_stream_pos(priv_data);
+	spin_unlock_irqrestore(&i2sdma->zxi2s_reg_lock, flags);
 	
 	return bytes_to_frames(substream->runtime,pos);
 }
 
+/*
+ * The DPL tracks what the DMA engine moved to/from memory. On playback the
+ * FIFO and the serializer still hold that much data before it reaches the
+ * link, on capture the same amount has been sampled but not written back.
+ * There is no FIFO level register, so a running stream is counted with a
+ * full FIFO. "delay_check" in debugfs measures the playback side.
+ */
+static snd_pcm_sframes_t zxi2s_delay_frames(struct zxi2s_stream_data *priv_data,
+					    struct snd_pcm_runtime *runtime)
+{
+	if (!priv_data->running)
+		return 0;
+	return bytes_to_frames(runtime, priv_data->fifo_bytes) + ZXI2S_LINK_DELAY_FRAMES;
+}
+
+static snd_pcm_sframes_t zxi2s_dma_delay(struct snd_soc_component *component,
+					 struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct zxi2s_stream_data *priv_data = runtime->private_data;
+
+	priv_data->delay = zxi2s_delay_frames(priv_data, runtime);
+	return priv_data->delay;
+}
+
+/*
+ * delay_check: frames between the DPL at @pos and the last one fetched whose
+ * channel 0 sample is @link, 1 is the frame right before @pos. -1: none of
+ * the @max_frames behind @pos.
+ */
+static int zxi2s_delay_lag(struct snd_pcm_runtime *runtime, unsigned int bufsize,
+			   unsigned int pos, u32 link, unsigned int max_frames)
+{
+	unsigned int fbytes = frames_to_bytes(runtime, 1);
+	unsigned int phys = snd_pcm_format_physical_width(runtime->format);
+	u32 mask = GENMASK(snd_pcm_format_width(runtime->format) - 1, 0);
+	unsigned int k, ofs;
+	u32 val;
+
+	for (k = 1; k <= max_frames; k++) {
+		ofs = (pos + bufsize - k * fbytes % bufsize) % bufsize;
+		if (phys == 16)
+			val = le16_to_cpu(*(__le16 *)(runtime->dma_area + ofs));
+		else
+			val = le32_to_cpu(*(__le32 *)(runtime->dma_area + ofs));
+		if (!((val ^ link) & mask))
+			return k;
+	}
+	return -1;
+}
+
 static int zxi2s_dma_hw_free(struct snd_soc_component *component,struct snd_pcm_substream *substream)
 {
-	return snd_pcm_lib_free_pages(substream);
+	/* the pages stay in the stream pool for the next hw_params */
+	snd_pcm_set_runtime_buffer(substream, NULL);
+	return 0;
 
 }
 
+/*
+ * make sure the stream pool holds at least @size bytes. A smaller pool is
+ * dropped and reallocated, a large enough one is reused as is.
+ */
+static int zxi2s_pool_reserve(struct zxi2s_dma *i2sdma,
+			      struct zxi2s_stream_data *priv_data, size_t size)
+{
+	int type = zxi2s_buffer_type(priv_data->wc);
+	int err;
+
+	/* PCM devices of different modes share the pool, the type must match */
+	if (priv_data->pool.area && priv_data->pool_type == type &&
+	    priv_data->pool.bytes >= size) {
+		priv_data->pool_hits++;
+		return 0;
+	}
+
+	priv_data->pool_misses++;
+	if (priv_data->pool.area)
+		snd_dma_free_pages(&priv_data->pool);
+
+	err = snd_dma_alloc_pages(type, i2sdma->dev, PAGE_ALIGN(size),
+				  &priv_data->pool);
+	if (err < 0) {
+		memset(&priv_data->pool, 0, sizeof(priv_data->pool));
+		return err;
+	}
+	priv_data->pool_type = type;
+	return 0;
+}
+
 
 static int zxi2s_dma_hw_params(struct snd_soc_component *component ,struct snd_pcm_substream *substream,
 			      struct snd_pcm_hw_params *params)
 {
-	return snd_pcm_lib_malloc_pages(substream, params_buffer_bytes(params));
+	struct zxi2s_dma *i2sdma = dev_get_drvdata(component->dev);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct zxi2s_stream_data *priv_data = runtime->private_data;
+	size_t size = params_buffer_bytes(params);
+	ktime_t start = ktime_get();
+	int ret;
+
+	ret = zxi2s_pool_reserve(i2sdma, priv_data, size);
+	priv_data->alloc_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ret < 0)
+		return ret;
+
+	snd_pcm_set_runtime_buffer(substream, &priv_data->pool);
+	runtime->dma_bytes = size;
+	return 0;
 
 }				  
 
+#ifdef CONFIG_DEBUG_FS
+static int zxi2s_dma_stats_show(struct seq_file *m, void *v)
+{
+	struct zxi2s_dma *i2sdma = m->private;
+	struct zxi2s_stream_data *priv_data;
+	int dir;
+
+	seq_printf(m, "hard irq:      %lu, avg %llu ns, max %llu ns, thread prio %d\n",
+		   i2sdma->hard_irqs,
+		   i2sdma->hard_irqs ? div_u64(i2sdma->hard_ns_total, i2sdma->hard_irqs) : 0,
+		   i2sdma->hard_ns_max, i2sdma->thread_prio);
+
+	for (dir = 0; dir < ZXI2S_DIRS; dir++) {
+		priv_data = &i2sdma->streams[dir];
+		seq_printf(m, "%s:\n", priv_data->direction == SNDRV_PCM_STREAM_PLAYBACK ?
+			   "playback" : "capture");
+		seq_printf(m, "  buffer:      %s%s, %u bytes, %u periods\n",
+			   sg_buffer ? "sg" : "contiguous",
+			   priv_data->wc ? " wc" : "", priv_data->bufsize,
+			   priv_data->period_bytes ?
+			   priv_data->bufsize / priv_data->period_bytes : 0);
+		seq_printf(m, "  descriptors: %u (%s%s)\n", priv_data->nr_desc,
+			   priv_data->ring ? "ring" : "classic",
+			   priv_data->period_wakeup ? "" : ", no period wakeup");
+		seq_printf(m, "  irqs:        %lu (every %u periods)\n",
+			   priv_data->irqs, priv_data->irq_interval);
+		seq_printf(m, "  alloc_ns:    %llu\n", priv_data->alloc_ns);
+		seq_printf(m, "  elapsed:     %lu (%s), irq to elapsed avg %llu ns, max %llu ns\n",
+			   priv_data->elapsed,
+			   priv_data->low_latency ? "hard irq" : "irq thread",
+			   priv_data->elapsed ?
+			   div64_ul(priv_data->elapsed_ns_total, priv_data->elapsed) : 0,
+			   priv_data->elapsed_ns_max);
+		seq_printf(m, "  xrun:        %lu, %lu stopped, >= %llu frames lost, recovery last %llu ns, max %llu ns\n",
+			   priv_data->xruns, priv_data->xruns_stopped,
+			   priv_data->xrun_lost_frames,
+			   priv_data->xrun_ns_last, priv_data->xrun_ns_max);
+		if (priv_data->silence)
+			seq_printf(m, "  freewheel:   %s, %lu underruns, last silent %llu ns\n",
+				   priv_data->freewheel ? "on" : "off",
+				   priv_data->fw_underruns, priv_data->fw_gap_ns);
+		seq_printf(m, "  fifo:        %u bytes, last delay %ld frames\n",
+			   priv_data->fifo_bytes, priv_data->delay);
+		seq_printf(m, "  pool:        %zu bytes, type %d (allocated as %d), %lu hits, %lu misses\n",
+			   priv_data->pool.bytes, priv_data->pool_type,
+			   priv_data->pool.dev.type, priv_data->pool_hits,
+			   priv_data->pool_misses);
+		seq_printf(m, "  trigger:     %lu, mmio reads %lu (last %u), writes %lu (last %u)\n",
+			   priv_data->triggers, priv_data->trigger_reads,
+			   priv_data->last_trigger_reads, priv_data->trigger_writes,
+			   priv_data->last_trigger_writes);
+		seq_printf(m, "  start:       last %llu ns, max %llu ns\n",
+			   priv_data->start_ns_last, priv_data->start_ns_max);
+		if (dir == SNDRV_PCM_STREAM_PLAYBACK)
+			seq_printf(m, "  drain:       %lu (%s), last %u wakeups, %llu ns, tail %llu ns\n",
+				   priv_data->drains, hw_drain ? "stopbuf" : "polled",
+				   priv_data->last_drain_wakeups,
+				   priv_data->last_drain_ns, priv_data->last_tail_ns);
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(zxi2s_dma_stats);
+
+/*
+ * "buffer_bench": time streaming writes into a cached and a write-combined
+ * buffer of the configured layout, in ns per MiB.
+ */
+#define ZXI2S_BENCH_BYTES		(1024 * 1024)
+#define ZXI2S_BENCH_PASSES		16
+
+static int zxi2s_dma_bench_show(struct seq_file *m, void *v)
+{
+	struct zxi2s_dma *i2sdma = m->private;
+	struct snd_dma_buffer dmab;
+	ktime_t start;
+	u64 ns;
+	int wc, pass, err;
+
+	for (wc = 0; wc < 2; wc++) {
+		err = snd_dma_alloc_pages(zxi2s_buffer_type(wc), i2sdma->dev,
+					  ZXI2S_BENCH_BYTES, &dmab);
+		if (err < 0)
+			return err;
+
+		memset(dmab.area, 0, ZXI2S_BENCH_BYTES);	/* fault in */
+		start = ktime_get();
+		for (pass = 0; pass < ZXI2S_BENCH_PASSES; pass++)
+			memset(dmab.area, pass, ZXI2S_BENCH_BYTES);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		seq_printf(m, "%-8s %llu ns/MiB\n", wc ? "wc" : "cached",
+			   div_u64(ns, ZXI2S_BENCH_PASSES));
+		snd_dma_free_pages(&dmab);
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(zxi2s_dma_bench);
+
+/*
+ * "inject_xrun": write a SNDRV_PCM_STREAM_* number to run the xrun path of
+ * that stream as if the hardware had flagged one
+ */
+static ssize_t zxi2s_inject_xrun_write(struct file *file, const char __user *buf,
+				       size_t count, loff_t *ppos)
+{
+	struct zxi2s_dma *i2sdma = file->private_data;
+	unsigned int dir;
+	int err;
+
+	err = kstrtouint_from_user(buf, count, 0, &dir);
+	if (err)
+		return err;
+	if (dir >= ZXI2S_DIRS)
+		return -EINVAL;
+
+	spin_lock_irq(&i2sdma->zxi2s_reg_lock);
+	i2sdma->int_sts[dir] |= OSDINTS_XRUN;
+	i2sdma->irq_stamp = ktime_get();
+	spin_unlock_irq(&i2sdma->zxi2s_reg_lock);
+
+	irq_wake_thread(i2sdma->irq, i2sdma);
+	return count;
+}
+
+static const struct file_operations zxi2s_inject_xrun_fops = {
+	.open	= simple_open,
+	.write	= zxi2s_inject_xrun_write,
+	.llseek	= default_llseek,
+};
+
+/*
+ * "delay_check": measure what .delay estimates. DACPD0S holds the channel 0
+ * sample the serializer is sending, right aligned as the link carries it.
+ * Looking that sample up behind the DPL gives the frames really fetched but
+ * not yet on the link. Play a signal whose channel 0 never repeats within a
+ * few FIFOs (a ramp) in a signed LE format, then read the file; each line is
+ * one sample of the lag next to what .delay reports.
+ */
+#define ZXI2S_DELAY_CHECK_SAMPLES	16
+
+static int zxi2s_delay_check_show(struct seq_file *m, void *v)
+{
+	struct zxi2s_dma *i2sdma = m->private;
+	struct zxi2s_stream_data *priv_data = &i2sdma->streams[SNDRV_PCM_STREAM_PLAYBACK];
+	struct snd_pcm_runtime *runtime;
+	snd_pcm_sframes_t delay;
+	unsigned int pos, max_frames, phys;
+	int i, lag, lag_min = INT_MAX, lag_max = -1, misses = 0;
+	u32 link;
+
+	spin_lock_irq(&i2sdma->zxi2s_reg_lock);
+	if (!priv_data->substream || !priv_data->running) {
+		spin_unlock_irq(&i2sdma->zxi2s_reg_lock);
+		seq_puts(m, "playback not running\n");
+		return 0;
+	}
+	runtime = priv_data->substream->runtime;
+	phys = snd_pcm_format_physical_width(runtime->format);
+	if (snd_pcm_format_signed(runtime->format) <= 0 ||
+	    snd_pcm_format_little_endian(runtime->format) <= 0 ||
+	    (phys != 16 && phys != 32)) {
+		spin_unlock_irq(&i2sdma->zxi2s_reg_lock);
+		seq_printf(m, "%s: the FIFO converts it, use a signed LE format\n",
+			   snd_pcm_format_name(runtime->format));
+		return 0;
+	}
+	delay = zxi2s_delay_frames(priv_data, runtime);
+	/* look four times as far back as the estimate before giving up */
+	max_frames = min_t(unsigned int, 4 * delay, runtime->buffer_size);
+	spin_unlock_irq(&i2sdma->zxi2s_reg_lock);
+
+	seq_printf(m, "reported %ld frames (fifo %u bytes + %d)\n",
+		   delay, priv_data->fifo_bytes, ZXI2S_LINK_DELAY_FRAMES);
+	for (i = 0; i < ZXI2S_DELAY_CHECK_SAMPLES; i++) {
+		spin_lock_irq(&i2sdma->zxi2s_reg_lock);
+		if (!priv_data->running) {
+			spin_unlock_irq(&i2sdma->zxi2s_reg_lock);
+			break;
+		}
+		pos = zxi2s_stream_pos(priv_data);
+		link = zxi2s_regmap_read(priv_data->regmap, ZXI2S_REG_DACPD0S);
+		lag = zxi2s_delay_lag(runtime, priv_data->bufsize, pos, link, max_frames);
+		spin_unlock_irq(&i2sdma->zxi2s_reg_lock);
+
+		if (lag < 0) {
+			misses++;
+			seq_printf(m, "  pos %u: link 0x%08x not found\n", pos, link);
+		} else {
+			lag_min = min(lag_min, lag);
+			lag_max = max(lag_max, lag);
+			seq_printf(m, "  pos %u: link 0x%08x, %d frames behind\n",
+				   pos, link, lag);
+		}
+		usleep_range(500, 1000);
+	}
+	if (lag_max >= 0)
+		seq_printf(m, "measured %d..%d frames, reported %ld, %d not found\n",
+			   lag_min, lag_max, delay, misses);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(zxi2s_delay_check);
+#endif
+
+/*
+ * "Playback/Capture Period IRQ Interval": raise IOC on every Nth period.
+ * Takes effect immediately, a classic BDL gets its IOC bits rewritten and a
+ * ring picks the new value up with the next queued descriptor.
+ */
+static int zxi2s_irq_interval_info(struct snd_kcontrol *kcontrol,
+				   struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 1;
+	uinfo->value.integer.min = 1;
+	uinfo->value.integer.max = ZXI2S_IRQ_INTERVAL_MAX;
+	return 0;
+}
+
+static int zxi2s_irq_interval_get(struct snd_kcontrol *kcontrol,
+				  struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct zxi2s_dma *i2sdma = dev_get_drvdata(component->dev);
+	struct zxi2s_stream_data *priv_data = &i2sdma->streams[kcontrol->private_value];
+
+	ucontrol->value.integer.value[0] = priv_data->irq_interval_req;
+	return 0;
+}
+
+static int zxi2s_irq_interval_put(struct snd_kcontrol *kcontrol,
+				  struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct zxi2s_dma *i2sdma = dev_get_drvdata(component->dev);
+	struct zxi2s_stream_data *priv_data = &i2sdma->streams[kcontrol->private_value];
+	long val = ucontrol->value.integer.value[0];
+	unsigned int i;
+
+	if (val < 1 || val > ZXI2S_IRQ_INTERVAL_MAX)
+		return -EINVAL;
+	if (priv_data->irq_interval_req == val)
+		return 0;
+
+	spin_lock_irq(&i2sdma->zxi2s_reg_lock);
+	priv_data->irq_interval_req = val;
+	if (priv_data->period_bytes) {
+		zxi2s_update_irq_interval(priv_data);
+
+		/* a ring picks the interval up as it queues */
+		for (i = 0; !priv_data->ring && priv_data->period_wakeup &&
+		     i < priv_data->frags; i++) {
+			struct zxi2s_bdl_slot *slot = &priv_data->slot[i];
+			__le32 *bdl = (__le32 *)priv_data->bdl->area + i * 4;
+
+			bdl[3] = zxi2s_want_ioc(priv_data, slot->ofs + slot->size) ?
+				 cpu_to_le32(ZXI2S_BDLE_IOC) : 0;
+		}
+	}
+	spin_unlock_irq(&i2sdma->zxi2s_reg_lock);
+
+	return 1;
+}
+
+#define ZXI2S_IRQ_INTERVAL(xname, dir) \
+{	.iface = SNDRV_CTL_ELEM_IFACE_MIXER, .name = xname, \
+	.info = zxi2s_irq_interval_info, \
+	.get = zxi2s_irq_interval_get, .put = zxi2s_irq_interval_put, \
+	.private_value = dir }
+
+static const struct snd_kcontrol_new zxi2s_dma_controls[] = {
+	ZXI2S_IRQ_INTERVAL("Playback Period IRQ Interval", SNDRV_PCM_STREAM_PLAYBACK),
+	ZXI2S_IRQ_INTERVAL("Capture Period IRQ Interval", SNDRV_PCM_STREAM_CAPTURE),
+};
+
+static int zxi2s_dma_component_probe(struct snd_soc_component *component)
+{
+#ifdef CONFIG_DEBUG_FS
+	struct zxi2s_dma *i2sdma = dev_get_drvdata(component->dev);
+
+	debugfs_create_file("stats", 0444, component->debugfs_root, i2sdma,
+			    &zxi2s_dma_stats_fops);
+	debugfs_create_file("buffer_bench", 0444, component->debugfs_root, i2sdma,
+			    &zxi2s_dma_bench_fops);
+	debugfs_create_file("inject_xrun", 0200, component->debugfs_root, i2sdma,
+			    &zxi2s_inject_xrun_fops);
+	debugfs_create_file("delay_check", 0444, component->debugfs_root, i2sdma,
+			    &zxi2s_delay_check_fops);
+#endif
+	return 0;
+}
+
 /*
 *在az的pcm_prepare函数里面，先在snd_hdac_stream_set_params这个函数里面确定buffersize
 *那几个东西，然后调用setup_period函数，这里面就用到了bdl.area,说明在这之前就申请好了
@@ -383,36 +1345,53 @@ static int zxi2s_dma_prepare(struct snd_soc_component *component ,struct snd_pcm
 	int err;
 	struct snd_pcm_runtime *runtime = substream->runtime;
 	struct zxi2s_stream_data *priv_data = runtime->private_data;
+	struct zxi2s_dma *i2sdma = dev_get_drvdata(component->dev);
 
 	priv_data->bufsize = snd_pcm_lib_buffer_bytes(substream);//alsa会根据min/max自己计算
 	priv_data->period_bytes = snd_pcm_lib_period_bytes(substream);
-	priv_data->frags = 4;
 
 	err = snd_i2s_stream_setup_periods(priv_data);
 	if (err < 0)
 		return err;
+	/* a fresh start, the next xrun may be resynchronised again */
+	priv_data->xrun_last = 0;
 	
 	//然后根据这些从app传到runtime再拉下来的数据，计算分频等波特率
 
+	/*
+	 * reset the engine of this direction once per prepare instead of on
+	 * every START/STOP, MODRST is pulsed even if the cache agrees. A pause
+	 * keeps the FIFO and the BDL position this way.
+	 */
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
+		zxi2s_reg_forceb(priv_data, ZXI2S_REG_MODRST, MODRST_DAC, 0);
+		zxi2s_reg_forceb(priv_data, ZXI2S_REG_MODRST, MODRST_DAC, MODRST_DAC);
+		/* the DRAIN trigger arms it again */
+		zxi2s_reg_updateb(priv_data, ZXI2S_REG_COMSET, COMSET_STOP_DAC_BUF, 0);
+	} else {
+		zxi2s_reg_forceb(priv_data, ZXI2S_REG_MODRST, MODRST_ADC, 0);
+		zxi2s_reg_forceb(priv_data, ZXI2S_REG_MODRST, MODRST_ADC, MODRST_ADC);
+	}
+
 	/* program the position buffer */
-	zxi2s_reg_writel(priv_data,ZXI2S_REG_DPLBASE, (u32)priv_data->posbuf.addr | DPLBASE_EN);
-	zxi2s_reg_writel(priv_data,ZXI2S_REG_DPUBASE, ZXI2S_REG_DPUBASE | upper_32_bits(priv_data->posbuf.addr));
+	zxi2s_reg_writel(priv_data,ZXI2S_REG_DPLBASE, lower_32_bits(i2sdma->posbuf->addr) | DPLBASE_EN);
+	zxi2s_reg_writel(priv_data,ZXI2S_REG_DPUBASE, upper_32_bits(i2sdma->posbuf->addr));
 
 	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
 	{
 		/* program the stream LVI (last valid index) of the BDL */
-		zxi2s_reg_writel(priv_data, ZXI2S_REG_OSDLVI, priv_data->frags-1);
+		zxi2s_reg_writeb(priv_data, ZXI2S_REG_OSDLVI, priv_data->lvi);
 		/* program the BDL address */
-		zxi2s_reg_writel(priv_data,ZXI2S_REG_OBDLUBASE, upper_32_bits(priv_data->bdl.addr));
-		zxi2s_reg_writel(priv_data,ZXI2S_REG_OBDLLBASE, ZXI2S_REG_OBDLLBASE | priv_data->bdl.addr);
+		zxi2s_reg_writel(priv_data,ZXI2S_REG_OBDLUBASE, upper_32_bits(priv_data->bdl->addr));
+		zxi2s_reg_writel(priv_data,ZXI2S_REG_OBDLLBASE, lower_32_bits(priv_data->bdl->addr));
 
 	}
 	else{
 		/* program the stream LVI (last valid index) of the BDL */
-		zxi2s_reg_writel(priv_data, ZXI2S_REG_ISDLVI, priv_data->frags-1);
+		zxi2s_reg_writeb(priv_data, ZXI2S_REG_ISDLVI, priv_data->lvi);
 		/* program the BDL address */
-		zxi2s_reg_writel(priv_data,ZXI2S_REG_IBDLUBASE, upper_32_bits(priv_data->bdl.addr));
-		zxi2s_reg_writel(priv_data,ZXI2S_REG_IBDLLBASE,  ZXI2S_REG_IBDLLBASE | priv_data->bdl.addr);
+		zxi2s_reg_writel(priv_data,ZXI2S_REG_IBDLUBASE, upper_32_bits(priv_data->bdl->addr));
+		zxi2s_reg_writel(priv_data,ZXI2S_REG_IBDLLBASE, lower_32_bits(priv_data->bdl->addr));
 	}
 
 	
@@ -422,99 +1401,369 @@ static int zxi2s_dma_prepare(struct snd_soc_component *component ,struct snd_pcm
 
 static int zxi2s_dma_mmap(struct snd_soc_component *component ,struct snd_pcm_substream *substream,struct vm_area_struct *area)
 {
+	struct zxi2s_stream_data *priv_data = substream->runtime->private_data;
+
+	/* the user mapping has to match the kernel one, no cached alias */
+	if (priv_data->wc)
+		area->vm_page_prot = pgprot_writecombine(area->vm_page_prot);
 
 	return snd_pcm_lib_default_mmap(substream, area);
 }
 
 
 
+/*
+ * soc_pcm_trigger() only passes START/STOP class commands down to the
+ * components, hand SNDRV_PCM_TRIGGER_DRAIN over directly
+ */
+static int zxi2s_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
+{
+	struct snd_soc_pcm_runtime *rtd = asoc_substream_to_rtd(substream);
+	struct snd_soc_component *component = snd_soc_rtdcom_lookup(rtd, ZXI2S_DMA_NAME);
+	struct zxi2s_dma *i2sdma = dev_get_drvdata(component->dev);
+
+	struct zxi2s_stream_data *priv_data = &i2sdma->streams[substream->stream];
+	unsigned long reads = i2sdma->pdata->mmio_reads;
+	unsigned long writes = i2sdma->pdata->mmio_writes;
+	ktime_t start = ktime_get();
+	u64 ns;
+	int ret;
+
+	if (cmd == SNDRV_PCM_TRIGGER_DRAIN)
+		ret = zxi2s_dma_trigger(component, substream, cmd);
+	else
+		ret = i2sdma->soc_trigger(substream, cmd);
+
+	/* an irq of the other stream landing in between is counted as well */
+	priv_data->last_trigger_reads = i2sdma->pdata->mmio_reads - reads;
+	priv_data->last_trigger_writes = i2sdma->pdata->mmio_writes - writes;
+	priv_data->trigger_reads += priv_data->last_trigger_reads;
+	priv_data->trigger_writes += priv_data->last_trigger_writes;
+	priv_data->triggers++;
+
+	/* the engine fetches as soon as START is set, the trigger path is the software share */
+	if (cmd == SNDRV_PCM_TRIGGER_START || cmd == SNDRV_PCM_TRIGGER_PAUSE_RELEASE ||
+	    cmd == SNDRV_PCM_TRIGGER_RESUME) {
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		priv_data->start_ns_last = ns;
+		priv_data->start_ns_max = max(priv_data->start_ns_max, ns);
+	}
+	return ret;
+}
+
 static int zxi2s_dma_new(struct snd_soc_component *component ,struct snd_soc_pcm_runtime *rtd)
 {
-	int i,err;
-	component = snd_soc_rtdcom_lookup(rtd,ZXI2S_DMA_NAME);
 	struct zxi2s_dma *i2sdma =  dev_get_drvdata(component->dev);
-	
-	for (i = 0; i<2; i++) {
-		struct zxi2s_stream_data *priv_data = kzalloc(sizeof(struct zxi2s_stream_data), GFP_KERNEL);
-		if (!priv_data)
-			return -ENOMEM;
-
-		priv_data->direction=i;
-		priv_data->regs = i2sdma->regs;
+	struct zxi2s_stream_data *priv_data;
+	int dir, err;
 
-		list_add_tail(&priv_data->list, &i2sdma->stream_list);
+	/* rtd->ops is what snd_pcm_set_ops() was handed */
+	if (rtd->ops.trigger != zxi2s_pcm_trigger) {
+		i2sdma->soc_trigger = rtd->ops.trigger;
+		rtd->ops.trigger = zxi2s_pcm_trigger;
 	}
 
-	/* allocate memory for the BDL for each stream */
-	list_for_each_entry(prvi_data, &i2sdma->stream_list, list) {
-		err = snd_dma_alloc_pages(SNDRV_DMA_TYPE_DEV, i2sdma->dev,4096, &priv_data->bdl);
+	/*
+	 * seed the per-direction pools, hw_params only reallocates when a
+	 * larger buffer is asked for. sg buffers keep large allocations
+	 * working on fragmented memory.
+	 */
+	for (dir = 0; dir < ZXI2S_DIRS; dir++) {
+		priv_data = &i2sdma->streams[dir];
+		if (priv_data->pool.area)
+			continue;
+		priv_data->wc = zxi2s_wc_buffer(rtd->pcm->device);
+		err = zxi2s_pool_reserve(i2sdma, priv_data, ZXI2S_POOL_BYTES_DEFAULT);
 		if (err < 0)
-			return -ENOMEM;
+			return err;
+		priv_data->pool_misses = 0;
 	}
 
-	/* allocate memory for the position buffer */
-	err = snd_dma_alloc_pages(SNDRV_DMA_TYPE_DEV, i2sdma->dev,2*8, &priv_data->posbuf);
+	return 0;
+}
 
-	list_for_each_entry(priv_data, &i2sdma->stream_list, list)
-		priv_data->posbuf = (__le32 *)(i2sdma->posbuf.area + ~(priv_data->direction)* 8);
+static void zxi2s_dma_free(struct snd_soc_component *component, struct snd_pcm *pcm)
+{
+	struct zxi2s_dma *i2sdma = dev_get_drvdata(component->dev);
+	struct zxi2s_stream_data *priv_data;
+	int dir;
 
+	for (dir = 0; dir < ZXI2S_DIRS; dir++) {
+		priv_data = &i2sdma->streams[dir];
+		if (priv_data->pool.area)
+			snd_dma_free_pages(&priv_data->pool);
+		memset(&priv_data->pool, 0, sizeof(priv_data->pool));
+	}
+}
 
-	snd_pcm_lib_preallocate_pages_for_all(rtd->pcm,
-						  SNDRV_DMA_TYPE_DEV,
-						  component->dev,  //这里是否要用parent?
-						  64*1024,	
-						  32*1024*1024);
 
 
-	return 0;
+/*
+ * FIFO xrun: the engine kept walking the BDL, only the link ran without data
+ * (playback) or dropped samples (capture). Resynchronise in place instead of
+ * the stop/prepare/start cycle with its MODRST:
+ * - halt the direction (START off, as PAUSE_PUSH does) so the serializer
+ *   restarts on a frame boundary instead of wherever the xrun left it;
+ * - look the hardware position up again from CURBUF, the slot walk only
+ *   follows forward progress;
+ * - re-arm LVI, in ring mode top the window up from CURBUF first;
+ * - count the link time from the xrun irq to the restart as lost frames,
+ *   what the FIFO missed before the irq is not visible.
+ * Returns false when the stream has to be stopped instead: while draining,
+ * or on a second xrun within one buffer time, which a resync did not cure.
+ * Called with zxi2s_reg_lock held.
+ */
+static bool zxi2s_xrun_resync(struct zxi2s_stream_data *priv_data, ktime_t stamp)
+{
+	struct snd_pcm_runtime *runtime = priv_data->substream->runtime;
+	u64 buffer_ns = div_u64((u64)runtime->buffer_size * NSEC_PER_SEC,
+				runtime->rate);
+	ktime_t now;
+
+	if (priv_data->draining ||
+	    (priv_data->xrun_last &&
+	     ktime_to_ns(ktime_sub(stamp, priv_data->xrun_last)) < buffer_ns))
+		return false;
+
+	if (priv_data->direction == SNDRV_PCM_STREAM_PLAYBACK)
+		zxi2s_reg_updatel(priv_data, ZXI2S_REG_DACIFCFG, DACIFCFG_START, 0);
+	else
+		zxi2s_reg_updateb(priv_data, ZXI2S_REG_ADCFIFOCFG, ADCFIFOCFG_START, 0);
+
+	priv_data->pos_slot = zxi2s_cur_buf(priv_data);
+	zxi2s_stream_pos(priv_data);
+
+	if (priv_data->ring) {
+		zxi2s_ring_refill(priv_data);
+		zxi2s_ring_set_lvi(priv_data);
+	} else if (priv_data->direction == SNDRV_PCM_STREAM_PLAYBACK) {
+		zxi2s_reg_writeb(priv_data, ZXI2S_REG_OSDLVI, priv_data->lvi);
+	} else {
+		zxi2s_reg_writeb(priv_data, ZXI2S_REG_ISDLVI, priv_data->lvi);
+	}
+
+	now = ktime_get();
+	priv_data->xrun_lost_frames +=
+		div_u64((u64)ktime_to_ns(ktime_sub(now, stamp)) * runtime->rate,
+			NSEC_PER_SEC);
+	priv_data->xrun_last = now;
+
+	if (priv_data->direction == SNDRV_PCM_STREAM_PLAYBACK)
+		zxi2s_reg_updatel(priv_data, ZXI2S_REG_DACIFCFG, DACIFCFG_START,
+				  DACIFCFG_START);
+	else
+		zxi2s_reg_updateb(priv_data, ZXI2S_REG_ADCFIFOCFG, ADCFIFOCFG_START,
+				  ADCFIFOCFG_START);
+	return true;
 }
 
+static void zxi2s_dma_xrun(struct zxi2s_dma *i2sdma,
+			   struct zxi2s_stream_data *priv_data)
+{
+	bool resynced;
+	u64 ns;
+
+	spin_lock_irq(&i2sdma->zxi2s_reg_lock);
+	priv_data->xruns++;
+	resynced = !xrun_stop && zxi2s_xrun_resync(priv_data, i2sdma->irq_stamp);
+	if (!resynced)
+		priv_data->xruns_stopped++;
+	spin_unlock_irq(&i2sdma->zxi2s_reg_lock);
+
+	if (!resynced)
+		snd_pcm_stop_xrun(priv_data->substream);
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), i2sdma->irq_stamp));
+	priv_data->xrun_ns_last = ns;
+	if (ns > priv_data->xrun_ns_max)
+		priv_data->xrun_ns_max = ns;
+}
 
+/* report a period, timed from the hard irq that raised it */
+static void zxi2s_period_elapsed(struct zxi2s_stream_data *priv_data, ktime_t stamp)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), stamp));
 
-/* TODO: */
-static irqreturn_t zxi2s_dma_irq_handle(int irq, void *dev_id)
+	priv_data->elapsed++;
+	priv_data->elapsed_ns_total += ns;
+	if (ns > priv_data->elapsed_ns_max)
+		priv_data->elapsed_ns_max = ns;
+
+	snd_pcm_period_elapsed(priv_data->substream);
+}
+
+/*
+ * low-latency profile: a classic BDL needs no refill, so the period can be
+ * reported right here instead of after a thread wakeup. Returns the IOC
+ * bit when it was consumed. Called with zxi2s_reg_lock held.
+ */
+static u8 zxi2s_ll_ioc(struct zxi2s_stream_data *priv_data, u8 sd_status)
 {
-	int err,res;
-	u8 sd_status;
-	struct zxi2s_stream_data *priv_data；
+	if (!priv_data->low_latency || !priv_data->running || priv_data->ring ||
+	    !priv_data->period_wakeup || priv_data->draining ||
+	    !(sd_status & OSDINTS_IOC))
+		return 0;
 
-	//首先要打开Rx08两个中断总控制bit
-	
+	priv_data->irqs++;
+	return OSDINTS_IOC;
+}
+
+/*
+ * hard irq: latch and ack OSDINTS/ISDINTS, everything else runs in the
+ * irq thread
+ */
+static irqreturn_t zxi2s_dma_irq_handle(int irq, void *dev_id)
+{
 	struct zxi2s_dma *i2sdma = (struct zxi2s_dma *)dev_id;
+	ktime_t start = ktime_get();
+	u8 osd_status, isd_status;
+	u8 ll_ioc[2];
+	bool wake;
+	int dir;
+	u64 ns;
+
+	osd_status = zxi2s_reg_readb(i2sdma, ZXI2S_REG_OSDINTS) & OSDINTS_ALL;
+	isd_status = zxi2s_reg_readb(i2sdma, ZXI2S_REG_ISDINTS) & ISDINTS_ALL;
+	if (!osd_status && !isd_status)
+		return IRQ_NONE;	/* shared line, not ours */
+
+	/* write 1 to clear */
+	if (osd_status)
+		zxi2s_reg_writeb(i2sdma, ZXI2S_REG_OSDINTS, osd_status);
+	if (isd_status)
+		zxi2s_reg_writeb(i2sdma, ZXI2S_REG_ISDINTS, isd_status);
+
+	spin_lock(&i2sdma->zxi2s_reg_lock);
+	ll_ioc[SNDRV_PCM_STREAM_PLAYBACK] =
+		zxi2s_ll_ioc(&i2sdma->streams[SNDRV_PCM_STREAM_PLAYBACK], osd_status);
+	ll_ioc[SNDRV_PCM_STREAM_CAPTURE] =
+		zxi2s_ll_ioc(&i2sdma->streams[SNDRV_PCM_STREAM_CAPTURE], isd_status);
+	osd_status &= ~ll_ioc[SNDRV_PCM_STREAM_PLAYBACK];
+	isd_status &= ~ll_ioc[SNDRV_PCM_STREAM_CAPTURE];
+	wake = osd_status || isd_status;
+
+	i2sdma->int_sts[SNDRV_PCM_STREAM_PLAYBACK] |= osd_status;
+	i2sdma->int_sts[SNDRV_PCM_STREAM_CAPTURE] |= isd_status;
+	i2sdma->irq_stamp = start;
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	i2sdma->hard_irqs++;
+	i2sdma->hard_ns_total += ns;
+	if (ns > i2sdma->hard_ns_max)
+		i2sdma->hard_ns_max = ns;
+	spin_unlock(&i2sdma->zxi2s_reg_lock);
+
+	/* the pointer callback takes zxi2s_reg_lock itself */
+	for (dir = 0; dir < ARRAY_SIZE(ll_ioc); dir++) {
+		if (ll_ioc[dir])
+			zxi2s_period_elapsed(&i2sdma->streams[dir], start);
+	}
+
+	return wake ? IRQ_WAKE_THREAD : IRQ_HANDLED;
+}
+
+/* pick up a changed irq_prio module parameter */
+static void zxi2s_dma_thread_prio(struct zxi2s_dma *i2sdma)
+{
+	struct sched_attr attr = {
+		.size		= sizeof(attr),
+		.sched_policy	= SCHED_FIFO,
+	};
+	int prio = clamp(READ_ONCE(irq_prio), 1, MAX_RT_PRIO - 1);
 
+	if (prio == i2sdma->thread_prio)
+		return;
+
+	attr.sched_priority = prio;
+	if (!sched_setattr_nocheck(current, &attr))
+		i2sdma->thread_prio = prio;
+}
+
+static irqreturn_t zxi2s_dma_irq_thread(int irq, void *dev_id)
+{
+	struct zxi2s_dma *i2sdma = (struct zxi2s_dma *)dev_id;
+	struct zxi2s_stream_data *priv_data;
+	u8 int_sts[2];
+	bool drained;
+	int dir;
+
+	zxi2s_dma_thread_prio(i2sdma);
+
+	spin_lock_irq(&i2sdma->zxi2s_reg_lock);
+	int_sts[SNDRV_PCM_STREAM_PLAYBACK] = i2sdma->int_sts[SNDRV_PCM_STREAM_PLAYBACK];
+	int_sts[SNDRV_PCM_STREAM_CAPTURE] = i2sdma->int_sts[SNDRV_PCM_STREAM_CAPTURE];
+	i2sdma->int_sts[SNDRV_PCM_STREAM_PLAYBACK] = 0;
+	i2sdma->int_sts[SNDRV_PCM_STREAM_CAPTURE] = 0;
+	spin_unlock_irq(&i2sdma->zxi2s_reg_lock);
+
+	for (dir = 0; dir < ZXI2S_DIRS; dir++) {
+		u8 sd_status = int_sts[dir];
+
+		priv_data = &i2sdma->streams[dir];
+
+		//如果发生Descriptor Error & FIFO Error
+		if (sd_status & (OSDINTS_ABORT | OSDINTS_XRUN))
+			dev_warn_ratelimited(i2sdma->dev, "%s %s%s\n",
+				priv_data->direction == SNDRV_PCM_STREAM_PLAYBACK ?
+				"playback" : "capture",
+				sd_status & OSDINTS_ABORT ? "dma abort " : "",
+				sd_status & OSDINTS_XRUN ? "fifo xrun" : "");
+
+		/* the end of a hardware drain runs the FIFO dry on purpose */
+		if (priv_data->running && !priv_data->draining &&
+		    (sd_status & OSDINTS_XRUN))
+			zxi2s_dma_xrun(i2sdma, priv_data);
+
+		if (!priv_data->running || !(sd_status & OSDINTS_IOC))
+			continue;
 
-	list_for_each_entry(priv_data, &i2sdma->stream_list, list) {
-
-		if(!(priv_data->direction)){	//playback
-			sd_status = zxi2s_reg_readb(priv_data,ZXI2S_REG_OSDINTS);
-			zxi2s_reg_updatew(priv_data,ZXI2S_REG_OSDINTS,OSDINTS_IOC,0);
-			if(priv_data->running | (sd_status & OSDINTS_IOC){
-				spin_unlock(&i2sdma->zxi2s_reg_lock);
-				snd_pcm_period_elapsed(priv_data->substream);
-				spin_lock(&i2sdma->zxi2s_reg_lock);
-				}
-			}
-		else {
-			sd_status = zxi2s_reg_readb(priv_data,ZXI2S_REG_ISDINTS);
-			zxi2s_reg_updatew(priv_data,ZXI2S_REG_ISDINTS,OSDINTS_IOC,0);
-			if(priv_data->running | (sd_status & ISDINTS_IOC){
-				spin_unlock(&i2sdma->zxi2s_reg_lock);
-				snd_pcm_period_elapsed(priv_data->substream);
-				spin_lock(&i2sdma->zxi2s_reg_lock);
-				}
-			}
+		spin_lock_irq(&i2sdma->zxi2s_reg_lock);
+		priv_data->irqs++;
+		/* ring mode: hand the engine the next descriptors before it hits LVI */
+		if (priv_data->ring)
+			zxi2s_ring_refill(priv_data);
+		/*
+		 * the stop descriptor is the only one left with IOC; its end,
+		 * not drain_ofs, is where the engine stops when it was already
+		 * being fetched at arm time. An IOC latched before the arm is
+		 * short of it.
+		 */
+		drained = priv_data->draining && priv_data->drain_idx >= 0 &&
+			  zxi2s_stream_pos(priv_data) ==
+			  zxi2s_drain_end(priv_data);
+
+		/* polled drain: only accounted, for comparison */
+		if (!priv_data->draining &&
+		    priv_data->substream->runtime->status->state == SNDRV_PCM_STATE_DRAINING) {
+			if (!priv_data->drain_start)
+				priv_data->drain_start = i2sdma->irq_stamp;
+			priv_data->drain_irq = i2sdma->irq_stamp;
 		}
-	
-	
-	//如果发生Descriptor Error & FIFO Error就直接停止
-	if(zxi2s_reg_readl(priv_data, ZXI2S_REG_ISDINTS)& ISDINTS_ABORT || 
-		zxi2s_reg_readl(priv_data, ZXI2S_REG_ISDINTS)& ISDINTS_XRUN ||
-		zxi2s_reg_readl(priv_data, ZXI2S_REG_OSDINTS)& ISDINTS_ABORT ||
-		zxi2s_reg_readl(priv_data, ZXI2S_REG_OSDINTS)& ISDINTS_XRUN)
-			dev_info(i2sdma->dev, "%s +%d :%s err happend \n",__FILE__, __LINE__, __func__);
-
- /`      
-	dev_info(i2sdma->dev, "%s +%d :%s \n",__FILE__, __LINE__, __func__);
+		if (priv_data->drain_start)
+			priv_data->drain_wakeups++;
+		spin_unlock_irq(&i2sdma->zxi2s_reg_lock);
+
+		if (priv_data->draining) {
+			/* a ring refill on the way to the stop descriptor */
+			if (!drained)
+				continue;
+
+			/* DMA stopped, sleep until the SRAM ran out on the link */
+			priv_data->drain_irq = i2sdma->irq_stamp;
+			usleep_range(priv_data->drain_fifo_us,
+				     priv_data->drain_fifo_us + 50);
+			zxi2s_period_elapsed(priv_data, i2sdma->irq_stamp);
+			continue;
+		}
+
+		/*
+		 * with an irq interval > 1 this covers several periods, the
+		 * core advances hw_ptr by whatever the pointer callback says
+		 */
+		if (priv_data->period_wakeup)
+			zxi2s_period_elapsed(priv_data, i2sdma->irq_stamp);
+	}
+
 	return IRQ_HANDLED;
 }
 
@@ -522,6 +1771,9 @@ static irqreturn_t zxi2s_dma_irq_handle(int irq, void *dev_id)
 //kernel version different big,use construct for pcm_new
 static const struct snd_soc_component_driver zxi2s_dma_drv = {
                 .name           = ZXI2S_DMA_NAME,
+        .probe          = zxi2s_dma_component_probe,
+        .controls       = zxi2s_dma_controls,
+        .num_controls   = ARRAY_SIZE(zxi2s_dma_controls),
         .open           = zxi2s_dma_open,
         .close          = zxi2s_dma_close,
         .hw_params      = zxi2s_dma_hw_params,
@@ -529,8 +1781,10 @@ static const struct snd_soc_component_driver zxi2s_dma_drv = {
         .prepare        = zxi2s_dma_prepare,
         .trigger        = zxi2s_dma_trigger,
         .pointer        = zxi2s_dma_pointer,
+        .delay          = zxi2s_dma_delay,
         .mmap           = zxi2s_dma_mmap,
                 .pcm_construct = zxi2s_dma_new,
+        .pcm_destruct   = zxi2s_dma_free,
 };
 
 
@@ -541,8 +1795,7 @@ static const struct snd_soc_component_driver zxi2s_dma_drv = {
 
 static int zxi2s_dma_probe(struct platform_device *pdev)
 {
-	int error = 0;
-	struct resource *res;
+	int error = 0, dir;
 	struct zxi2s_dma *i2sdma;
 
 	i2sdma = devm_kzalloc(&pdev->dev, sizeof(*i2sdma), GFP_KERNEL);
@@ -551,12 +1804,13 @@ static int zxi2s_dma_probe(struct platform_device *pdev)
 		return -ENOMEM;
 	}
 
-	/* get mmio */
-	i2sdma->regs = devm_platform_get_and_ioremap_resource(pdev, 0, &res);
-	if (IS_ERR(i2sdma->regs)) {
-		dev_err(&pdev->dev, "get regs base failed\n");
-		return -ENOMEM;
+	/* registers are mapped once by the PCI function */
+	i2sdma->regmap = dev_get_regmap(pdev->dev.parent, NULL);
+	if (!i2sdma->regmap) {
+		dev_err(&pdev->dev, "get regmap failed\n");
+		return -ENODEV;
 	}
+	i2sdma->pdata = dev_get_drvdata(pdev->dev.parent);
 
 	/* get irq */
 	i2sdma->irq = platform_get_irq(pdev, 0);
@@ -566,12 +1820,51 @@ static int zxi2s_dma_probe(struct platform_device *pdev)
 	}
 
 	i2sdma->dev = &pdev->dev;
+	spin_lock_init(&i2sdma->zxi2s_reg_lock);
+
+	i2sdma->streams = (struct zxi2s_stream_data *)
+		devm_get_free_pages(&pdev->dev, GFP_KERNEL | __GFP_ZERO,
+				    get_order(ZXI2S_DIRS * sizeof(*i2sdma->streams)));
+	if (!i2sdma->streams)
+		return -ENOMEM;
+
+	/* BDLs and the shared DPL page live as long as the device */
+	i2sdma->posbuf = snd_devm_alloc_pages(&pdev->dev, SNDRV_DMA_TYPE_DEV, 2 * 8);
+	if (!i2sdma->posbuf)
+		return -ENOMEM;
+
+	for (dir = 0; dir < ZXI2S_DIRS; dir++) {
+		struct zxi2s_stream_data *priv_data = &i2sdma->streams[dir];
+
+		priv_data->direction = dir;
+		priv_data->regmap = i2sdma->regmap;
+		priv_data->irq_interval_req = 1;
+		priv_data->irq_interval = 1;
+		priv_data->posbuf = (__le32 *)(i2sdma->posbuf->area + ZXI2S_DPL_OFFSET(dir));
+		priv_data->bdl = snd_devm_alloc_pages(&pdev->dev, SNDRV_DMA_TYPE_DEV,
+						      ZXI2S_BDL_BYTES);
+		if (!priv_data->bdl)
+			return -ENOMEM;
+	}
+
+	/* freewheel padding */
+	i2sdma->streams[SNDRV_PCM_STREAM_PLAYBACK].silence =
+		snd_devm_alloc_pages(&pdev->dev, SNDRV_DMA_TYPE_DEV, PAGE_SIZE);
+
+	/* FIFO depth, falls back to the documented 32 bytes */
+	i2sdma->streams[SNDRV_PCM_STREAM_PLAYBACK].fifo_bytes =
+		zxi2s_reg_readw(i2sdma, ZXI2S_REG_OSDFIFOSIZE) ? :
+		zxi2s_pcm_hardware_playback.fifo_size;
+	i2sdma->streams[SNDRV_PCM_STREAM_CAPTURE].fifo_bytes =
+		zxi2s_reg_readw(i2sdma, ZXI2S_REG_ISDFIFOSIZE) ? :
+		zxi2s_pcm_hardware_capture.fifo_size;
+
 	platform_set_drvdata(pdev, (void *)i2sdma);
 	dev_set_drvdata(&pdev->dev, i2sdma);
 
-	/* request irq */
-	if (devm_request_irq(&pdev->dev, i2sdma->irq, zxi2s_dma_irq_handle,
-				IRQF_SHARED, pdev->name, i2sdma)) {
+	/* request irq, the hard handler only acks and wakes the thread */
+	if (devm_request_threaded_irq(&pdev->dev, i2sdma->irq, zxi2s_dma_irq_handle,
+				zxi2s_dma_irq_thread, IRQF_SHARED, pdev->name, i2sdma)) {
 		dev_err(i2sdma->dev, "i2sdma IRQ%d allocate failed.\n",i2sdma->irq);
 		return -ENODEV;
 	}
@@ -582,7 +1875,7 @@ static int zxi2s_dma_probe(struct platform_device *pdev)
 		dev_err(&pdev->dev, "Fail to register ALSA platform device\n");
 		return error;
 	}
-'/'
+
 	pm_runtime_set_autosuspend_delay(&pdev->dev, 10000);
 	pm_runtime_use_autosuspend(&pdev->dev);
 	pm_runtime_enable(&pdev->dev);
@@ -591,21 +1884,20 @@ static int zxi2s_dma_probe(struct platform_device *pdev)
 	return 0;
 }
 
+/*
+ * everything is devm: the component goes first and its pcm_destruct
+ * (zxi2s_dma_free) releases the pools while drvdata is still valid,
+ * then the irq, the BDL pages and the struct itself
+ */
 static int zxi2s_dma_remove(struct platform_device *pdev)
 {
-	struct zxi2s_dma *i2sdma = platform_get_drvdata(pdev);
-
-	devm_free_irq(&pdev->dev, i2sdma->irq, i2sdma);
-	platform_set_drvdata(pdev, NULL);
-	devm_kfree(&pdev->dev, i2sdma);
-
 	dev_info(&pdev->dev, "driver removed.\n");
 	return 0;
 }
 
 
 /* Initialize and bring ACP hardware to default state. */
-static int zxi2s_dma_init(void __iomem *zxi2s_mmio)+
+static int zxi2s_dma_init(struct regmap *regmap)
 {
 	//通过T/P spec流程来
 	return 0;
@@ -620,7 +1912,7 @@ static int zxi2s_pcm_resume(struct device *dev)
 	struct zxi2s_stream_data *priv_data;
 	struct zxi2s_dma *i2sdma = dev_get_drvdata(dev);
 
-	status = zxi2s_dma_init(i2sdma->regs);
+	status = zxi2s_dma_init(i2sdma->regmap);
 
 	if (status) {
 		dev_err(dev, "zxi2s Init failed status:%d\n", status);
@@ -646,7 +1938,7 @@ static int zxi2s_pcm_runtime_resume(struct device *dev)
 {
 	int status;
 	struct zxi2s_dma *i2sdma = dev_get_drvdata(dev);
-	status = zxi2s_dma_init(i2sdma->regs);
+	status = zxi2s_dma_init(i2sdma->regmap);
 	if (status) {
 		dev_err(dev, "zxi2s Init failed status:%d\n", status);
 		return status;
@@ -676,7 +1968,35 @@ static struct platform_driver zxi2s_dma_driver = {
 	},
 };
 
-module_platform_driver(zxi2s_dma_driver);
+#ifdef ZXI2S_KUNIT_TEST
+#include "dma_zx_i2s_test.c"
+#else
+static inline int zxi2s_dma_test_init(void) { return 0; }
+static inline void zxi2s_dma_test_exit(void) { }
+#endif
+
+static int __init zxi2s_dma_module_init(void)
+{
+	int ret;
+
+	ret = zxi2s_dma_test_init();
+	if (ret)
+		return ret;
+
+	ret = platform_driver_register(&zxi2s_dma_driver);
+	if (ret)
+		zxi2s_dma_test_exit();
+	return ret;
+}
+
+static void __exit zxi2s_dma_module_exit(void)
+{
+	platform_driver_unregister(&zxi2s_dma_driver);
+	zxi2s_dma_test_exit();
+}
+
+module_init(zxi2s_dma_module_init);
+module_exit(zxi2s_dma_module_exit);
 MODULE_AUTHOR("hanshu@zhaoxin.com");
 MODULE_DESCRIPTION("ZHAOXIN I2S dma driver");
 MODULE_VERSION(DRIVER_VERSION);
@@ -0,0 +1,491 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *      dma_zx_i2s_test.c - KUnit checks of the BDL slot table, ring mode and
+ *      the period bounds open sets
+ *
+ *      Copyright(c) 2021 Shanghai Zhaoxin Corporation. All rights reserved.
+ *
+ *	Built into dma_zx_i2s.c with "make ZXI2S_KUNIT=1" (needs CONFIG_KUNIT),
+ *	the suites run when the module loads. The registers are a plain array
+ *	behind a regmap, the PCM buffer is a contiguous fake at ZXI2S_TEST_ADDR,
+ *	only its addresses end up in the BDL; tests that write samples give it
+ *	a dma_area.
+*/
+#include <kunit/test.h>
+
+#define ZXI2S_TEST_REGS		0x200
+#define ZXI2S_TEST_ADDR		0x10000000
+
+struct zxi2s_dma_test {
+	u32 regs[ZXI2S_TEST_REGS];
+	struct regmap *regmap;
+	struct zxi2s_stream_data *priv;
+	struct snd_pcm_substream substream;
+	struct snd_pcm_runtime runtime;
+	struct snd_dma_buffer dmab;
+	struct snd_dma_buffer bdl;
+	__le32 dpl;
+};
+
+static int zxi2s_test_reg_read(void *context, unsigned int reg, unsigned int *val)
+{
+	struct zxi2s_dma_test *t = context;
+
+	if (reg >= ZXI2S_TEST_REGS)
+		return -EINVAL;
+	*val = t->regs[reg];
+	return 0;
+}
+
+static int zxi2s_test_reg_write(void *context, unsigned int reg, unsigned int val)
+{
+	struct zxi2s_dma_test *t = context;
+
+	if (reg >= ZXI2S_TEST_REGS)
+		return -EINVAL;
+	t->regs[reg] = val;
+	return 0;
+}
+
+static const struct regmap_config zxi2s_test_regmap_config = {
+	.name		= "zxi2s-test",
+	.reg_bits	= 32,
+	.val_bits	= 32,
+	.max_register	= ZXI2S_TEST_REGS - 1,
+	.reg_read	= zxi2s_test_reg_read,
+	.reg_write	= zxi2s_test_reg_write,
+	.cache_type	= REGCACHE_NONE,
+};
+
+static int zxi2s_dma_test_init_case(struct kunit *test)
+{
+	struct zxi2s_dma_test *t;
+
+	t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t);
+	t->priv = kunit_kzalloc(test, sizeof(*t->priv), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t->priv);
+	t->bdl.area = kunit_kzalloc(test, ZXI2S_BDL_BYTES, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t->bdl.area);
+
+	t->regmap = regmap_init(NULL, NULL, t, &zxi2s_test_regmap_config);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t->regmap);
+
+	/* S16_LE stereo, 4 bytes a frame */
+	t->runtime.format = SNDRV_PCM_FORMAT_S16_LE;
+	t->runtime.channels = 2;
+	t->runtime.frame_bits = 32;
+	t->runtime.dma_buffer_p = &t->dmab;
+	t->substream.runtime = &t->runtime;
+	t->dmab.dev.type = SNDRV_DMA_TYPE_CONTINUOUS;
+	t->dmab.addr = ZXI2S_TEST_ADDR;
+
+	t->priv->substream = &t->substream;
+	t->priv->regmap = t->regmap;
+	t->priv->direction = SNDRV_PCM_STREAM_PLAYBACK;
+	t->priv->bdl = &t->bdl;
+	t->priv->posbuf = &t->dpl;
+	t->priv->irq_interval_req = 1;
+	t->priv->irq_interval = 1;
+
+	test->priv = t;
+	return 0;
+}
+
+static void zxi2s_dma_test_exit_case(struct kunit *test)
+{
+	struct zxi2s_dma_test *t = test->priv;
+
+	regmap_exit(t->regmap);
+}
+
+static void zxi2s_test_layout(struct zxi2s_dma_test *t, unsigned int period_bytes,
+			      unsigned int periods)
+{
+	t->priv->period_bytes = period_bytes;
+	t->priv->bufsize = period_bytes * periods;
+	t->dmab.bytes = t->priv->bufsize;
+	t->runtime.period_size = bytes_to_frames(&t->runtime, period_bytes);
+	t->runtime.buffer_size = bytes_to_frames(&t->runtime, t->priv->bufsize);
+}
+
+static unsigned int zxi2s_test_pos(struct zxi2s_dma_test *t, u32 dpl)
+{
+	t->dpl = cpu_to_le32(dpl);
+	return zxi2s_stream_pos(t->priv);
+}
+
+/* bus address of BDL entry @idx as the engine would fetch it */
+static u64 zxi2s_test_bdl_addr(struct zxi2s_dma_test *t, unsigned int idx)
+{
+	__le32 *bdl = (__le32 *)t->bdl.area + idx * 4;
+
+	return le32_to_cpu(bdl[0]) | (u64)le32_to_cpu(bdl[1]) << 32;
+}
+
+/* classic BDL: one entry per period, DPL maps 1:1 and restarts at entry 0 */
+static void zxi2s_test_classic_pos(struct kunit *test)
+{
+	struct zxi2s_dma_test *t = test->priv;
+	struct zxi2s_stream_data *priv = t->priv;
+	int i;
+
+	zxi2s_test_layout(t, 1024, 4);
+	KUNIT_ASSERT_EQ(test, snd_i2s_stream_setup_periods(priv), 0);
+
+	KUNIT_EXPECT_FALSE(test, priv->ring);
+	KUNIT_EXPECT_EQ(test, priv->frags, 4U);
+	KUNIT_EXPECT_EQ(test, priv->lvi, 3U);
+	for (i = 0; i < 4; i++) {
+		KUNIT_EXPECT_EQ(test, priv->slot[i].ofs, i * 1024U);
+		KUNIT_EXPECT_EQ(test, priv->slot[i].lpos, i * 1024U);
+		KUNIT_EXPECT_EQ(test, zxi2s_test_bdl_addr(t, i),
+				(u64)ZXI2S_TEST_ADDR + i * 1024);
+	}
+
+	KUNIT_EXPECT_EQ(test, zxi2s_test_pos(t, 0), 0U);
+	KUNIT_EXPECT_EQ(test, zxi2s_test_pos(t, 1500), 1500U);
+	KUNIT_EXPECT_EQ(test, zxi2s_test_pos(t, 4095), 4095U);
+	KUNIT_EXPECT_EQ(test, priv->pos_slot, 3U);
+	/* wrapped to entry 0: the lookup starts over */
+	KUNIT_EXPECT_EQ(test, zxi2s_test_pos(t, 100), 100U);
+	KUNIT_EXPECT_EQ(test, priv->pos_slot, 0U);
+}
+
+/*
+ * 512 periods of one page each need more entries than the BDL has: the
+ * window is queued, refilled behind CURBUF, and LVI follows it around the
+ * 8-bit index while the slot table keeps mapping DPL to buffer offsets.
+ */
+static void zxi2s_test_ring_wrap(struct kunit *test)
+{
+	struct zxi2s_dma_test *t = test->priv;
+	struct zxi2s_stream_data *priv = t->priv;
+	unsigned int frags;
+
+	zxi2s_test_layout(t, PAGE_SIZE, 512);
+	KUNIT_ASSERT_EQ(test, snd_i2s_stream_setup_periods(priv), 0);
+
+	KUNIT_EXPECT_TRUE(test, priv->ring);
+	KUNIT_EXPECT_EQ(test, priv->nr_desc, 512U);
+	KUNIT_EXPECT_EQ(test, priv->frags, (unsigned int)ZXI2S_RING_WINDOW);
+	KUNIT_EXPECT_EQ(test, priv->lvi, ZXI2S_RING_WINDOW - 1U);
+	KUNIT_EXPECT_EQ(test, priv->fill_ofs, ZXI2S_RING_WINDOW * (unsigned int)PAGE_SIZE);
+
+	/* engine half way through the window: top it up, LVI follows */
+	t->regs[ZXI2S_REG_OSDCURBUF] = 64;
+	zxi2s_ring_refill(priv);
+	KUNIT_EXPECT_EQ(test, priv->frags, 64U + ZXI2S_RING_WINDOW);
+	KUNIT_EXPECT_EQ(test, t->regs[ZXI2S_REG_OSDLVI], 64U + ZXI2S_RING_WINDOW - 1);
+
+	/* a full window queued already: nothing to do */
+	frags = priv->frags;
+	zxi2s_ring_refill(priv);
+	KUNIT_EXPECT_EQ(test, priv->frags, frags);
+
+	/* the pointer callback has followed the engine so far */
+	KUNIT_EXPECT_EQ(test, zxi2s_test_pos(t, 100 * PAGE_SIZE),
+			100 * (unsigned int)PAGE_SIZE);
+	KUNIT_EXPECT_EQ(test, priv->pos_slot, 100U);
+
+	/* past entry 255 the index wraps, the entries get rewritten */
+	t->regs[ZXI2S_REG_OSDCURBUF] = 150;
+	zxi2s_ring_refill(priv);
+	KUNIT_EXPECT_EQ(test, priv->frags, 150U + ZXI2S_RING_WINDOW);
+	KUNIT_EXPECT_EQ(test, t->regs[ZXI2S_REG_OSDLVI],
+			(150U + ZXI2S_RING_WINDOW - 1) & ZXI2S_BDL_MASK);
+	KUNIT_EXPECT_EQ(test, priv->slot[0].ofs, 256 * (unsigned int)PAGE_SIZE);
+	KUNIT_EXPECT_EQ(test, priv->slot[0].lpos, 0U);
+	KUNIT_EXPECT_EQ(test, zxi2s_test_bdl_addr(t, 0),
+			(u64)ZXI2S_TEST_ADDR + 256 * PAGE_SIZE);
+
+	/* DPL before the wrap maps through the old entries... */
+	KUNIT_EXPECT_EQ(test, zxi2s_test_pos(t, 250 * PAGE_SIZE + 8),
+			250 * (unsigned int)PAGE_SIZE + 8);
+	KUNIT_EXPECT_EQ(test, priv->pos_slot, 250U);
+	/* ...and after it through the rewritten ones */
+	KUNIT_EXPECT_EQ(test, zxi2s_test_pos(t, 10), 256 * (unsigned int)PAGE_SIZE + 10);
+	KUNIT_EXPECT_EQ(test, priv->pos_slot, 0U);
+
+	/* second lap of the BDL: the end of the buffer wraps to its start */
+	t->regs[ZXI2S_REG_OSDCURBUF] = 20;
+	zxi2s_ring_refill(priv);
+	KUNIT_EXPECT_EQ(test, priv->frags, 276U + ZXI2S_RING_WINDOW);
+	t->regs[ZXI2S_REG_OSDCURBUF] = 136;
+	zxi2s_ring_refill(priv);
+	KUNIT_EXPECT_EQ(test, priv->frags, 392U + ZXI2S_RING_WINDOW);
+	KUNIT_EXPECT_EQ(test, priv->slot[511 & ZXI2S_BDL_MASK].ofs,
+			511 * (unsigned int)PAGE_SIZE);
+	KUNIT_EXPECT_EQ(test, priv->slot[512 & ZXI2S_BDL_MASK].ofs, 0U);
+	KUNIT_EXPECT_EQ(test, priv->fill_ofs, 8 * (unsigned int)PAGE_SIZE);
+}
+
+/* 256 KiB sg periods take 64 descriptors: a ring must IOC every period */
+static void zxi2s_test_ring_interval(struct kunit *test)
+{
+	struct zxi2s_dma_test *t = test->priv;
+	struct zxi2s_stream_data *priv = t->priv;
+
+	zxi2s_test_layout(t, 256 * 1024, 8);
+	priv->irq_interval_req = 2;
+	zxi2s_update_irq_interval(priv);
+	KUNIT_EXPECT_EQ(test, priv->irq_interval, 2U);
+
+	priv->ring = true;
+	priv->period_desc = 64;
+	zxi2s_update_irq_interval(priv);
+	KUNIT_EXPECT_EQ(test, priv->irq_interval, 1U);
+
+	/* one page periods: the buffer length is the only limit */
+	priv->period_desc = 1;
+	priv->irq_interval_req = 32;
+	zxi2s_update_irq_interval(priv);
+	KUNIT_EXPECT_EQ(test, priv->irq_interval, 4U);
+}
+
+/* IOC flags of the BDL, one bit per entry of the first @n */
+static unsigned long zxi2s_test_ioc_mask(struct zxi2s_dma_test *t, unsigned int n)
+{
+	__le32 *bdl = (__le32 *)t->bdl.area;
+	unsigned long mask = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		if (le32_to_cpu(bdl[i * 4 + 3]) & ZXI2S_BDLE_IOC)
+			mask |= BIT(i);
+	return mask;
+}
+
+/*
+ * hardware drain with the last byte at 1500 of a 4 x 1024 buffer. Entry 1
+ * holds it: cut short while it is still queued, silenced past 1500 once the
+ * engine fetches it. Either way the engine stops where the pointer says.
+ */
+static void zxi2s_test_drain_arm(struct kunit *test)
+{
+	struct zxi2s_dma_test *t = test->priv;
+	struct zxi2s_stream_data *priv = t->priv;
+	u8 *area;
+	int i;
+
+	area = kunit_kmalloc(test, 4096, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, area);
+	memset(area, 0x55, 4096);
+	t->dmab.area = area;
+	t->runtime.dma_area = area;
+	zxi2s_test_layout(t, 1024, 4);
+	KUNIT_ASSERT_EQ(test, snd_i2s_stream_setup_periods(priv), 0);
+
+	/* engine on entry 0: entry 1 not fetched yet */
+	priv->draining = true;
+	priv->drain_ofs = 1500;
+	t->regs[ZXI2S_REG_OSDCURBUF] = 0;
+	zxi2s_drain_arm(priv);
+	KUNIT_EXPECT_EQ(test, priv->drain_idx, 1);
+	KUNIT_EXPECT_EQ(test, priv->slot[1].size, 476U);
+	KUNIT_EXPECT_EQ(test, t->regs[ZXI2S_REG_OSDSTOPBUF], 1U);
+	KUNIT_EXPECT_EQ(test, t->regs[ZXI2S_REG_OSDLVI], 1U);
+	KUNIT_EXPECT_EQ(test, zxi2s_test_ioc_mask(t, 4), BIT(1));
+	KUNIT_EXPECT_EQ(test, zxi2s_drain_end(priv), 1500U);
+	KUNIT_EXPECT_EQ(test, zxi2s_test_pos(t, 1024 + 476), 1500U);
+	KUNIT_EXPECT_EQ(test, (int)area[1500], 0x55);
+
+	/* engine already on entry 1: full length, the stale tail silenced */
+	KUNIT_ASSERT_EQ(test, snd_i2s_stream_setup_periods(priv), 0);
+	priv->pos_slot = 0;
+	t->regs[ZXI2S_REG_OSDCURBUF] = 1;
+	zxi2s_drain_arm(priv);
+	KUNIT_EXPECT_EQ(test, priv->drain_idx, 1);
+	KUNIT_EXPECT_EQ(test, priv->slot[1].size, 1024U);
+	KUNIT_EXPECT_EQ(test, zxi2s_test_ioc_mask(t, 4), BIT(1));
+	KUNIT_EXPECT_EQ(test, zxi2s_drain_end(priv), 2048U);
+	/* an IOC latched before the arm is short of the end */
+	KUNIT_EXPECT_NE(test, zxi2s_test_pos(t, 1024), zxi2s_drain_end(priv));
+	KUNIT_EXPECT_EQ(test, zxi2s_test_pos(t, 2048), zxi2s_drain_end(priv));
+	for (i = 0; i < 1500; i++)
+		if (area[i] != 0x55)
+			break;
+	KUNIT_EXPECT_EQ(test, i, 1500);
+	for (i = 1500; i < 2048; i++)
+		if (area[i])
+			break;
+	KUNIT_EXPECT_EQ(test, i, 2048);
+	KUNIT_EXPECT_EQ(test, (int)area[2048], 0x55);
+}
+
+/*
+ * fault injection: an xrun 1 ms ago on entry 2 of a classic BDL, then on a
+ * ring. The engine ends up running again from CURBUF with LVI re-armed and
+ * the lost link time counted; a repeat within one buffer time, or an xrun
+ * while draining, is left to snd_pcm_stop_xrun().
+ */
+static void zxi2s_test_xrun_resync(struct kunit *test)
+{
+	struct zxi2s_dma_test *t = test->priv;
+	struct zxi2s_stream_data *priv = t->priv;
+	ktime_t stamp;
+
+	t->runtime.rate = 48000;
+	zxi2s_test_layout(t, 1024, 4);
+	KUNIT_ASSERT_EQ(test, snd_i2s_stream_setup_periods(priv), 0);
+	priv->running = true;
+
+	t->regs[ZXI2S_REG_OSDCURBUF] = 2;
+	t->regs[ZXI2S_REG_OSDLVI] = 0;
+	t->dpl = cpu_to_le32(2100);
+	stamp = ktime_sub_us(ktime_get(), 1000);
+	KUNIT_EXPECT_TRUE(test, zxi2s_xrun_resync(priv, stamp));
+	KUNIT_EXPECT_EQ(test, priv->pos_slot, 2U);
+	KUNIT_EXPECT_EQ(test, t->regs[ZXI2S_REG_OSDLVI], 3U);
+	KUNIT_EXPECT_TRUE(test, t->regs[ZXI2S_REG_DACIFCFG] & DACIFCFG_START);
+	KUNIT_EXPECT_GE(test, priv->xrun_lost_frames, 48ULL);
+	KUNIT_EXPECT_EQ(test, zxi2s_test_pos(t, 2100), 2100U);
+
+	/* again right away: 1024 frames are 21 ms, the resync did not help */
+	KUNIT_EXPECT_FALSE(test, zxi2s_xrun_resync(priv, ktime_get()));
+	priv->xrun_last = 0;
+	priv->draining = true;
+	KUNIT_EXPECT_FALSE(test, zxi2s_xrun_resync(priv, ktime_get()));
+	priv->draining = false;
+
+	/* ring: the window is topped up from CURBUF before LVI is re-armed */
+	zxi2s_test_layout(t, PAGE_SIZE, 512);
+	KUNIT_ASSERT_EQ(test, snd_i2s_stream_setup_periods(priv), 0);
+	priv->xrun_last = 0;
+	t->regs[ZXI2S_REG_OSDCURBUF] = 64;
+	t->dpl = cpu_to_le32(64 * PAGE_SIZE + 16);
+	KUNIT_EXPECT_TRUE(test, zxi2s_xrun_resync(priv, ktime_get()));
+	KUNIT_EXPECT_EQ(test, priv->frags, 64U + ZXI2S_RING_WINDOW);
+	KUNIT_EXPECT_EQ(test, t->regs[ZXI2S_REG_OSDLVI], 64U + ZXI2S_RING_WINDOW - 1);
+	KUNIT_EXPECT_EQ(test, priv->pos_slot, 64U);
+	KUNIT_EXPECT_TRUE(test, t->regs[ZXI2S_REG_DACIFCFG] & DACIFCFG_START);
+}
+
+/*
+ * period bounds open derives from the FIFO depth: a period never shorter than
+ * what the FIFO holds (two of them on a low latency device), never longer
+ * than ZXI2S_PERIOD_BYTES_MAX, and only whole periods in the buffer
+ */
+static void zxi2s_test_open_bounds(struct kunit *test)
+{
+	struct zxi2s_dma_test *t = test->priv;
+	struct snd_soc_component *component;
+	struct zxi2s_dma *i2sdma;
+	struct snd_pcm *pcm;
+	struct device *dev;
+	struct snd_interval *periods;
+	bool saved = low_latency[1];
+
+	component = kunit_kzalloc(test, sizeof(*component), GFP_KERNEL);
+	i2sdma = kunit_kzalloc(test, sizeof(*i2sdma), GFP_KERNEL);
+	pcm = kunit_kzalloc(test, sizeof(*pcm), GFP_KERNEL);
+	dev = kunit_kzalloc(test, sizeof(*dev), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, component);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, i2sdma);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, pcm);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dev);
+	spin_lock_init(&i2sdma->zxi2s_reg_lock);
+	i2sdma->streams = t->priv;
+	dev_set_drvdata(dev, i2sdma);
+	component->dev = dev;
+	t->substream.pcm = pcm;
+	t->substream.stream = SNDRV_PCM_STREAM_PLAYBACK;
+
+	/* as probe would read it from a 64 byte OSDFIFOSIZE */
+	t->priv->fifo_bytes = 64;
+	t->priv->substream = NULL;
+	pcm->device = 0;
+	KUNIT_ASSERT_EQ(test, zxi2s_dma_open(component, &t->substream), 0);
+	KUNIT_EXPECT_EQ(test, t->runtime.hw.fifo_size, 64UL);
+	KUNIT_EXPECT_EQ(test, t->runtime.hw.period_bytes_min, 64UL);
+	KUNIT_EXPECT_EQ(test, t->runtime.hw.period_bytes_max, (size_t)ZXI2S_PERIOD_BYTES_MAX);
+	KUNIT_EXPECT_LE(test, t->runtime.hw.period_bytes_max, t->runtime.hw.buffer_bytes_max);
+	/* a FIFO worth is whole frames of the widest format */
+	KUNIT_EXPECT_EQ(test, t->runtime.hw.period_bytes_min %
+			(ZXI2S_CHANNELS_MAX * sizeof(u32)), 0UL);
+	periods = constrs_interval(&t->runtime.hw_constraints, SNDRV_PCM_HW_PARAM_PERIODS);
+	KUNIT_EXPECT_TRUE(test, periods->integer);
+
+	/* the second open of a direction is refused */
+	KUNIT_EXPECT_EQ(test, zxi2s_dma_open(component, &t->substream), -EBUSY);
+
+	/* low latency: two FIFOs a period, half the BDL */
+	low_latency[1] = true;
+	t->priv->substream = NULL;
+	pcm->device = 1;
+	memset(&t->runtime.hw, 0, sizeof(t->runtime.hw));
+	KUNIT_EXPECT_EQ(test, zxi2s_dma_open(component, &t->substream), 0);
+	low_latency[1] = saved;
+	KUNIT_EXPECT_EQ(test, t->runtime.hw.period_bytes_min, 128UL);
+	KUNIT_EXPECT_EQ(test, t->runtime.hw.periods_max, ZXI2S_BDL_ENTRIES / 2U);
+	KUNIT_EXPECT_EQ(test, t->runtime.hw.period_bytes_max, (size_t)ZXI2S_PERIOD_BYTES_MAX);
+}
+
+/*
+ * delay_check lookup on a ramp: channel 0 of frame n is n, channel 1 its
+ * complement. The frame on the link is found behind the DPL, across the
+ * buffer end too, and a sample not within reach is not found.
+ */
+static void zxi2s_test_delay_lag(struct kunit *test)
+{
+	struct zxi2s_dma_test *t = test->priv;
+	unsigned int frames = 1024, n;
+	__le16 *area;
+
+	zxi2s_test_layout(t, 1024, 4);
+	area = kunit_kzalloc(test, t->priv->bufsize, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, area);
+	t->runtime.dma_area = (unsigned char *)area;
+	for (n = 0; n < frames; n++) {
+		area[2 * n] = cpu_to_le16(n);
+		area[2 * n + 1] = cpu_to_le16(~n);
+	}
+
+	/* DPL at frame 512, the link sends frame 503: 9 frames in flight */
+	KUNIT_EXPECT_EQ(test, zxi2s_delay_lag(&t->runtime, t->priv->bufsize,
+					      512 * 4, 503, 64), 9);
+	KUNIT_EXPECT_EQ(test, zxi2s_delay_lag(&t->runtime, t->priv->bufsize,
+					      512 * 4, 511, 64), 1);
+	/* DPL at frame 2, link on frame 1020 of the previous pass */
+	KUNIT_EXPECT_EQ(test, zxi2s_delay_lag(&t->runtime, t->priv->bufsize,
+					      2 * 4, 1020, 64), 6);
+	/* further back than asked, and a sample that is not in the buffer */
+	KUNIT_EXPECT_EQ(test, zxi2s_delay_lag(&t->runtime, t->priv->bufsize,
+					      512 * 4, 400, 64), -1);
+	KUNIT_EXPECT_EQ(test, zxi2s_delay_lag(&t->runtime, t->priv->bufsize,
+					      512 * 4, 0xffff, 64), -1);
+}
+
+static struct kunit_case zxi2s_dma_test_cases[] = {
+	KUNIT_CASE(zxi2s_test_classic_pos),
+	KUNIT_CASE(zxi2s_test_ring_wrap),
+	KUNIT_CASE(zxi2s_test_ring_interval),
+	KUNIT_CASE(zxi2s_test_drain_arm),
+	KUNIT_CASE(zxi2s_test_xrun_resync),
+	KUNIT_CASE(zxi2s_test_open_bounds),
+	KUNIT_CASE(zxi2s_test_delay_lag),
+	{}
+};
+
+static struct kunit_suite zxi2s_dma_test_suite = {
+	.name		= "zxi2s-dma",
+	.init		= zxi2s_dma_test_init_case,
+	.exit		= zxi2s_dma_test_exit_case,
+	.test_cases	= zxi2s_dma_test_cases,
+};
+
+static struct kunit_suite *zxi2s_dma_test_suites[] = {
+	&zxi2s_dma_test_suite,
+	NULL
+};
+
+/* called from module init, kunit_test_suites() would take module_init itself */
+static int zxi2s_dma_test_init(void)
+{
+	return __kunit_test_suites_init(zxi2s_dma_test_suites);
+}
+
+static void zxi2s_dma_test_exit(void)
+{
+	__kunit_test_suites_exit(zxi2s_dma_test_suites);
+}
@@ -16,12 +16,147 @@
 #include <asm/io.h>
 #include <linux/version.h>
 #include <linux/platform_device.h>
+#include <linux/regmap.h>
 #include "zx_i2s.h"
 
-struct zxi2s_pdata {
-	void __iomem *zxi2s_base;
-	struct resource *res;
-	struct platform_device *pdev[ZXI2S_DEVS];
+/* access width of each register, 0: hole */
+static unsigned int zxi2s_reg_width(unsigned int reg)
+{
+	switch (reg) {
+	case ZXI2S_REG_DPLBASE:
+	case ZXI2S_REG_DPUBASE:
+	case ZXI2S_REG_DACIFCFG:
+	case ZXI2S_REG_DACMASK:
+	case ZXI2S_REG_DACPD0S:
+	case ZXI2S_REG_DACPD1S:
+	case ZXI2S_REG_ADCPD0S:
+	case ZXI2S_REG_ADCPD1S:
+	case ZXI2S_REG_IBDLLBASE:
+	case ZXI2S_REG_IBDLUBASE:
+	case ZXI2S_REG_OBDLLBASE:
+	case ZXI2S_REG_OBDLUBASE:
+		return 4;
+	case ZXI2S_REG_WSLENMST:
+	case ZXI2S_REG_WSLENSLV:
+	case ZXI2S_REG_ISDFIFOSIZE:
+	case ZXI2S_REG_OSDFIFOSIZE:
+		return 2;
+	case ZXI2S_REG_COMSET:
+	case ZXI2S_REG_MODRST:
+	case ZXI2S_REG_INTCTRL:
+	case ZXI2S_REG_DACFIFOCFG:
+	case ZXI2S_REG_DACROUTER:
+	case ZXI2S_REG_ADCIFCFG:
+	case ZXI2S_REG_ADCFIFOCFG:
+	case ZXI2S_REG_ISDINTE:
+	case ZXI2S_REG_ISDINTS:
+	case ZXI2S_REG_ISDLVI:
+	case ZXI2S_REG_ISDSTOPBUF:
+	case ZXI2S_REG_ISDCURBUF:
+	case ZXI2S_REG_OSDINTE:
+	case ZXI2S_REG_OSDINTS:
+	case ZXI2S_REG_OSDLVI:
+	case ZXI2S_REG_OSDSTOPBUF:
+	case ZXI2S_REG_OSDCURBUF:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static bool zxi2s_readable_reg(struct device *dev, unsigned int reg)
+{
+	return zxi2s_reg_width(reg);
+}
+
+/*
+ * status, sample data and DMA position change under us, everything else is
+ * cached. MODRST only takes reset pulses, a cached value would be replayed
+ * by regcache_sync().
+ */
+static bool zxi2s_volatile_reg(struct device *dev, unsigned int reg)
+{
+	switch (reg) {
+	case ZXI2S_REG_MODRST:
+	case ZXI2S_REG_WSLENSLV:
+	case ZXI2S_REG_DACPD0S:
+	case ZXI2S_REG_DACPD1S:
+	case ZXI2S_REG_ADCPD0S:
+	case ZXI2S_REG_ADCPD1S:
+	case ZXI2S_REG_ISDINTS:
+	case ZXI2S_REG_ISDCURBUF:
+	case ZXI2S_REG_OSDINTS:
+	case ZXI2S_REG_OSDCURBUF:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int zxi2s_regmap_reg_read(void *context, unsigned int reg, unsigned int *val)
+{
+	struct zxi2s_pdata *pdata = context;
+	void __iomem *addr = pdata->zxi2s_base + reg;
+
+	switch (zxi2s_reg_width(reg)) {
+	case 4:
+		*val = readl(addr);
+		break;
+	case 2:
+		*val = readw(addr);
+		break;
+	case 1:
+		*val = readb(addr);
+		break;
+	default:
+		return -EINVAL;
+	}
+	pdata->mmio_reads++;
+	return 0;
+}
+
+static int zxi2s_regmap_reg_write(void *context, unsigned int reg, unsigned int val)
+{
+	struct zxi2s_pdata *pdata = context;
+	void __iomem *addr = pdata->zxi2s_base + reg;
+
+	switch (zxi2s_reg_width(reg)) {
+	case 4:
+		writel(val, addr);
+		break;
+	case 2:
+		writew(val, addr);
+		break;
+	case 1:
+		writeb(val, addr);
+		break;
+	default:
+		return -EINVAL;
+	}
+	pdata->mmio_writes++;
+	return 0;
+}
+
+/*
+ * fast_io: the dma irq handler reads the status registers and writes
+ * INTS/LVI/START through it, so the cache must never allocate: a flat array
+ * over the 0x120 byte register file. Without reg_defaults a flat cache would
+ * hand out 0 for registers nobody wrote yet, num_reg_defaults_raw makes
+ * regcache_init() read the non-volatile ones back from the hardware instead.
+ */
+static const struct regmap_config zxi2s_regmap_config = {
+	.reg_bits = 32,
+	.val_bits = 32,
+	.reg_stride = 1,
+	.max_register = ZXI2S_REG_OBDLUBASE,
+	.reg_read = zxi2s_regmap_reg_read,
+	.reg_write = zxi2s_regmap_reg_write,
+	.readable_reg = zxi2s_readable_reg,
+	.writeable_reg = zxi2s_readable_reg,
+	.volatile_reg = zxi2s_volatile_reg,
+	.cache_type = REGCACHE_FLAT,
+	.num_reg_defaults_raw = ZXI2S_REG_OBDLUBASE + 1,
+	.fast_io = true,
 };
 
 static int zxi2s_pci_suspend(struct device *dev)
@@ -32,8 +167,21 @@ static int zxi2s_pci_suspend(struct device *dev)
 
 static int zxi2s_pci_resume(struct device *dev)
 {
+	struct zxi2s_pdata *pdata = dev_get_drvdata(dev);
+
 	dev_info(dev, "%s\n", __func__);
-	return 0;
+	/*
+	 * the function may have lost its state, write the cached config back.
+	 * Nothing runs across a suspend, a trigger sets START again: drop it
+	 * from the cache first so the sync does not start the engines.
+	 */
+	regcache_cache_only(pdata->regmap, true);
+	regmap_update_bits(pdata->regmap, ZXI2S_REG_DACIFCFG, DACIFCFG_START, 0);
+	regmap_update_bits(pdata->regmap, ZXI2S_REG_ADCFIFOCFG, ADCFIFOCFG_START, 0);
+	regcache_cache_only(pdata->regmap, false);
+
+	regcache_mark_dirty(pdata->regmap);
+	return regcache_sync(pdata->regmap);
 }
 
 
@@ -82,6 +230,14 @@ static int zxi2s_pci_probe(struct pci_dev *pci,
 	pci_set_master(pci);
 	pci_set_drvdata(pci, pdata);
 
+	/* the children find it with dev_get_regmap(parent) */
+	pdata->regmap = devm_regmap_init(&pci->dev, NULL, pdata, &zxi2s_regmap_config);
+	if (IS_ERR(pdata->regmap)) {
+		dev_err(&pci->dev, "regmap init failed\n");
+		ret = PTR_ERR(pdata->regmap);
+		goto release_regions;
+	}
+
 	/*
 	  TODO: do some init. Maybe needn't
 	*/
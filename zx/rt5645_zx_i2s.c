@@ -13,6 +13,10 @@
 #include <linux/acpi.h>
 #include <linux/slab.h>
 #include <linux/delay.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/clk.h>
+#include <linux/gcd.h>
 #include <sound/core.h>
 #include <sound/jack.h>
 #include <sound/pcm.h>
@@ -20,17 +24,132 @@
 #include <sound/soc.h>
 #include <sound/soc-acpi.h>
 #include "zx_i2s.h"
+#include "zx_i2s_clk.h"
 #include "5645.h"
 
 static struct snd_soc_jack headset_jack;
 
-/* machine's private date, not used yet */
+/*
+ * ASRC 模式: codec 的 stereo DA/AD filter 时钟改成跟踪 I2S1 (RT5645_ASRC_2/3)，
+ * codec 的 filter 跑在 sysclk 上，LRCK 不用跟 sysclk 同源。codec 的速率放开
+ * 到 cpu dai 的列表 (5512-96000)，7350/14700/29400 这些 codec 位图里没有的
+ * 速率 plan 是精确的，不用再交给 alsa-lib plug 重采样。
+ *
+ * ASRC 不改变样本数：plan 不精确时 link 按 plan.rate 放，内容就快/慢
+ * err_ppm，时间戳跟着漂。所以 asrc_tolerance 只放行听不出来的误差，默认
+ * 100 ppm 只让 5512 (+90 ppm，link 实际是 5512.5 Hz) 通过，11000 (+2272 ppm)
+ * 不行。非精确 plan 的真实 link 速率通过 hw_params 的 rate_num/rate_den
+ * 报给应用。
+ */
+static bool asrc;
+module_param(asrc, bool, 0444);
+MODULE_PARM_DESC(asrc, "Clock the codec filters from sysclk through its ASRC, opening the non-standard rates (default: off)");
+
+static unsigned int asrc_tolerance = 100;
+module_param(asrc_tolerance, uint, 0444);
+MODULE_PARM_DESC(asrc_tolerance, "Link rate error accepted in ASRC mode, in ppm (default: 100)");
+
+/* per direction, the link plans ASRC mode let through */
+struct zxi2s_mc_asrc_stats {
+	bool running;			/* hw_params .. hw_free */
+	bool inexact;			/* current stream's link plan is off by err_ppm */
+	int err_ppm;
+	unsigned int link_num;		/* link rate of the current stream */
+	unsigned int link_den;
+	unsigned long streams;
+	unsigned long inexact_streams;
+};
+
+/*
+ * codec 时钟上次的设置，相同就不再走 I2C。两个 dai_link 的 hw_params 由
+ * card->pcm_mutex 串行，不另加锁。
+ */
+struct zxi2s_mc_clk_state {
+	int sysclk_src;			/* RT5645_SCLK_S_*, -1: not programmed yet */
+	unsigned int sysclk;
+	unsigned int pll_in;		/* 0: PLL1 not programmed */
+	unsigned int pll_out;
+
+	unsigned long reconfigs;	/* hw_params calls */
+	unsigned long pll_calls;	/* set_pll actually issued */
+	unsigned long sysclk_calls;	/* set_sysclk actually issued */
+	unsigned long mclk_direct;	/* sysclk straight from MCLK, no PLL lock */
+	unsigned long restores;		/* sysclk re-applied on Platform Clock power up */
+	struct zxi2s_clk_plan plan;	/* of the last hw_params */
+	unsigned int rate;		/* of the last hw_params, 0: none yet */
+	u64 last_ns;			/* last hw_params */
+	u64 max_ns;
+};
+
+/* machine's private date */
 struct zxi2s_mc_private {
 	struct snd_soc_jack jack;
 	char codec_name[SND_ACPI_I2C_ID_LEN];
-	struct clk *mclk;
+	struct clk *mclk;		/* ZXI2S_MCLK_NAME from the cpu driver */
+	struct zxi2s_mc_clk_state clk;
+	struct zxi2s_mc_asrc_stats asrc[2];	/* SNDRV_PCM_STREAM_* */
+
+	/* 卡绑定期间 codec dai 用的能力描述副本，见 zx_init_caps() */
+	struct snd_soc_dai *codec_dai;
+	struct snd_soc_dai_driver *codec_drv_orig;
+	struct snd_soc_dai_driver codec_drv;
 };
 
+/*
+ * codec sysclk: MCLK 是 256fs 的 1/2/3/4/6/8/12/16 倍时 (zxi2s_clk_codec_direct,
+ * rl6231 的 pre-divider 能分到 256fs) 直接当 sysclk (RT5645_SCLK_S_MCLK)，省掉
+ * PLL 和它的 lock 时间；planner 在精确的 plan 里优先挑这种 MCLK。否则 PLL1 从
+ * MCLK 倍频到 512fs：48 bit 帧 (MCLK = BDIV x 48 fs) 总是这样，32 bit 帧在
+ * 8k/16k/32k 只有 384fs 也是。
+ *
+ * 速率上限是 96k：RT5645 AIF1 只声明 SNDRV_PCM_RATE_8000_96000，soc_pcm
+ * 跟 cpu dai 求交集后 128k 以上在这块卡上开不出来。cpu dai 的 192k 留给能
+ * 跑这些速率的 codec，debugfs 的 rates 文件把它们列在 "|" 后面。
+ */
+static int zx_codec_clk_set(struct snd_soc_dai *codec_dai,
+			    struct zxi2s_mc_clk_state *cs,
+			    const struct zxi2s_clk_plan *plan, unsigned int rate)
+{
+	unsigned int sysclk;
+	int src, ret;
+
+	if (plan->exact && zxi2s_clk_codec_direct(plan->mclk, rate)) {
+		src = RT5645_SCLK_S_MCLK;
+		sysclk = plan->mclk;
+		cs->mclk_direct++;
+	} else {
+		src = RT5645_SCLK_S_PLL1;
+		sysclk = rate * 512;
+		if (cs->pll_in != plan->mclk || cs->pll_out != sysclk) {
+			//here we set pll sorce as MCLK,pll in(MCLK?)=mclk,pllout=sysclk
+			ret = snd_soc_dai_set_pll(codec_dai, 0, RT5645_PLL1_S_MCLK,
+						  plan->mclk, sysclk);
+			if (ret < 0) {
+				cs->pll_in = 0;
+				dev_err(codec_dai->dev, "can't set codec pll: %d\n", ret);
+				return ret;
+			}
+			cs->pll_in = plan->mclk;
+			cs->pll_out = sysclk;
+			cs->pll_calls++;
+		}
+	}
+
+	if (cs->sysclk_src == src && cs->sysclk == sysclk)
+		return 0;
+
+	ret = snd_soc_dai_set_sysclk(codec_dai, src, sysclk, 0);
+	if (ret < 0) {
+		cs->sysclk_src = -1;
+		dev_err(codec_dai->dev, "can't set codec sysclk: %d\n", ret);
+		return ret;
+	}
+	cs->sysclk_src = src;
+	cs->sysclk = sysclk;
+	cs->sysclk_calls++;
+	return 0;
+}
+
 
 /*
 codec_dai 硬件参数设置，根据上层声道、采样率、数据格式，来配置 codec_dai 寄存器。
@@ -43,59 +162,70 @@ static int zx_aif1_hw_params(struct snd_pcm_substream *substream,
 {
 	int ret = 0;
 	struct snd_soc_pcm_runtime *rtd = asoc_substream_to_rtd(substream);
-	struct snd_soc_dai *codec_dai = asoc_rtd_to_codec(rtd,0);
 	//struct snd_soc_dai *cpu_dai = asoc_rtd_to_cpu(rtd,0);
+	struct zxi2s_mc_private *drv = snd_soc_card_get_drvdata(rtd->card);
+	struct zxi2s_mc_asrc_stats *st = &drv->asrc[substream->stream];
+	struct zxi2s_mc_clk_state *cs = &drv->clk;
+	u64 t0 = ktime_get_ns();
 
-	int mclk;
-	int zx_pll_1=36864000;
-	int zx_pll_2=33868800;
+	struct zxi2s_clk_plan plan;
+	unsigned int frame_bits;
 	
-/*仿照rockchip_rt5645,没有对codec pll和sysclk的设置*/
-	switch (params_rate(params)) {
-	case 8000:
-		mclk = zx_pll_1/12;
-		break;
-	case 24000:
-		mclk = zx_pll_1/4;
-		break;
-	case 32000:
-		mclk = zx_pll_1/3;
-		break;		
-	case 48000:
-		mclk = zx_pll_1/2;
-		break;			
-	case 96000:
-		mclk = zx_pll_1/2;
-		break;	
-	case 192000:
-		mclk = zx_pll_1;
-		break;		
-	case 44100:
-		mclk = zx_pll_2/2;
-		break;
-	default:
-		return -EINVAL;
-	}
-
-
-	//here we set pll sorce as MCLK,pll in(MCLK?)=mclk,pllout=512fs
-	ret = snd_soc_dai_set_pll(codec_dai, 0, RT5645_PLL1_S_MCLK,
-				  mclk, params_rate(params) * 512);
+	/*
+	 * MCLK is PLL / MDIV of the same plan the cpu dai programs, capture
+	 * always runs a stereo frame. The cpu dai rejects plans out of tolerance.
+	 * The rate goes through the clock framework first, it refuses with
+	 * -EBUSY while the other direction holds a different MCLK.
+	 */
+	frame_bits = zxi2s_clk_frame_bits(zxi2s_clk_lrck(params_width(params)),
+			substream->stream == SNDRV_PCM_STREAM_PLAYBACK ?
+			params_channels(params) : 2);
+	ret = zxi2s_clk_plan(params_rate(params), frame_bits, &plan);
 	if (ret < 0) {
-		dev_err(rtd->dev, "can't set codec pll: %d\n", ret);
+		dev_err(rtd->dev, "no clock plan for %d Hz, %u bit frame\n",
+			params_rate(params), frame_bits);
 		return ret;
 	}
-	
-	//根据codec spec，sysclk can select from MCLK/pll,here we
-	//choose pll as src(clk_id),and set sysclk output to 512fs
-	ret = snd_soc_dai_set_sysclk(codec_dai, RT5645_SCLK_S_PLL1,
-				params_rate(params) * 512, 0);
+
+	ret = clk_set_rate(drv->mclk, plan.mclk);
 	if (ret < 0) {
-		dev_err(rtd->dev, "can't set codec sysclk: %d\n", ret);
+		dev_err(rtd->dev, "can't set mclk to %u: %d\n", plan.mclk, ret);
 		return ret;
 	}
 
+	cs->reconfigs++;
+	ret = zx_codec_clk_set(asoc_rtd_to_codec(rtd, 0), cs, &plan,
+			       params_rate(params));
+	cs->last_ns = ktime_get_ns() - t0;
+	cs->max_ns = max(cs->max_ns, cs->last_ns);
+	if (ret < 0)
+		return ret;
+	cs->plan = plan;
+	cs->rate = params_rate(params);
+
+	/*
+	 * sysclk 按标称速率算，非精确 plan 时 link 实际跑 plan.rate，cpu dai
+	 * 只放行 tolerance 以内的。真实速率写进 rate_num/rate_den，soc_pcm 把
+	 * 同一个 params 交给 snd_pcm_hw_params()，应用读到的就是 link 速率。
+	 */
+	if (!plan.exact) {
+		unsigned int num, den, g;
+
+		zxi2s_clk_link_rate(&plan, frame_bits, &num, &den);
+		g = gcd(num, den);
+		params->rate_num = num / g;
+		params->rate_den = den / g;
+	}
 
+	if (asrc) {
+		if (!st->running) {
+			st->streams++;
+			st->running = true;
+		}
+		st->inexact = !plan.exact;
+		st->err_ppm = plan.err_ppm;
+		zxi2s_clk_link_rate(&plan, frame_bits, &st->link_num, &st->link_den);
+	}
 
 /*
     //在codec spec里面，在slavemode里面也会设置PLL（例程也是=521fs）
@@ -140,6 +270,109 @@ static int zx_aif1_hw_params(struct snd_pcm_substream *substream,
 	return ret;
 }
 
+static int zx_aif1_hw_free(struct snd_pcm_substream *substream)
+{
+	struct snd_soc_pcm_runtime *rtd = asoc_substream_to_rtd(substream);
+	struct zxi2s_mc_private *drv = snd_soc_card_get_drvdata(rtd->card);
+	struct zxi2s_mc_asrc_stats *st = &drv->asrc[substream->stream];
+
+	if (!st->running)
+		return 0;
+
+	if (st->inexact)
+		st->inexact_streams++;
+	st->running = false;
+	return 0;
+}
+
+/*
+ * stereo DA/AD filter 时钟源选 I2S1 ASRC，并把 asrc_tolerance 交给 cpu dai
+ * 重新规划可用速率。两个 dai_link 共用这个 cpu dai，这里做一次就够了。
+ *
+ * codec 的速率在 zx_init_caps() 的副本上放开。
+ */
+static int zx_init_asrc(struct snd_soc_pcm_runtime *runtime)
+{
+	struct snd_soc_component *component = asoc_rtd_to_codec(runtime, 0)->component;
+	int ret;
+
+	ret = rt5645_sel_asrc_clk_src(component,
+				      RT5645_DA_STEREO_FILTER | RT5645_AD_STEREO_FILTER,
+				      RT5645_CLK_SEL_I2S1_ASRC);
+	if (ret) {
+		dev_err(runtime->dev, "can't select codec asrc: %d\n", ret);
+		return ret;
+	}
+
+	ret = snd_soc_dai_set_clkdiv(asoc_rtd_to_cpu(runtime, 0),
+				     ZXI2S_CLKDIV_TOLERANCE, asrc_tolerance);
+	if (ret) {
+		dev_err(runtime->dev, "can't set cpu rate tolerance: %d\n", ret);
+		return ret;
+	}
+	return 0;
+}
+
+/*
+ * cpu dai 的 DAC FIFO 把 unsigned 和 BE 格式转换成 signed LE 再送上 link，
+ * rt5645_hw_params() 也只看位宽 (8/16/20/24)。codec AIF1 playback 只声明了
+ * S8/S16_LE/S20_3LE/S24_LE，soc_pcm 求交集会把其余格式丢掉，这里按位宽补上。
+ * 32 bit 的 S32/U32 codec 不支持，仍然只能由 plug 转换；capture FIFO 没有
+ * 转换器，capture 格式不动。
+ */
+#define ZX_LINK_PLAYBACK_FORMATS	(SNDRV_PCM_FMTBIT_S8 | SNDRV_PCM_FMTBIT_U8 | \
+		SNDRV_PCM_FMTBIT_S16_LE | SNDRV_PCM_FMTBIT_S16_BE | \
+		SNDRV_PCM_FMTBIT_U16_LE | SNDRV_PCM_FMTBIT_U16_BE | \
+		SNDRV_PCM_FMTBIT_S24_LE | SNDRV_PCM_FMTBIT_S24_BE | \
+		SNDRV_PCM_FMTBIT_U24_LE | SNDRV_PCM_FMTBIT_U24_BE)
+
+/*
+ * soc_pcm 在 open 时从 codec_dai->driver 取能力求交集，dai_link 的 startup
+ * 在那之前跑，hw rule 只能收窄，没法补格式和速率。rt5645_dai[] 是 codec 模块的
+ * 静态表，不能改：卡绑定期间让 codec dai 指向卡自己的副本，改副本，
+ * zx_exit() 解绑时换回原来的表，别的卡和重新绑定看到的还是 codec 自己
+ * 声明的能力。放在 zx_init() 最后，失败路径上不会留下指向副本的指针。
+ */
+static void zx_init_caps(struct snd_soc_pcm_runtime *runtime)
+{
+	struct zxi2s_mc_private *drv = snd_soc_card_get_drvdata(runtime->card);
+	struct snd_soc_dai *codec_dai = asoc_rtd_to_codec(runtime, 0);
+	struct snd_soc_pcm_stream *stream;
+	int dir;
+
+	drv->codec_dai = codec_dai;
+	drv->codec_drv_orig = codec_dai->driver;
+	drv->codec_drv = *codec_dai->driver;
+	drv->codec_drv.playback.formats |= ZX_LINK_PLAYBACK_FORMATS &
+					   ZXI2S_PLAYBACK_FORMATS;
+
+	/*
+	 * ASRC: codec 的 SNDRV_PCM_RATE_8000_96000 位图跟 cpu dai 的 KNOT 求
+	 * 交集后只剩标准速率，换成 KNOT 加 5512-96000 的范围，速率列表由 cpu
+	 * dai 的 hw_rule 给出。上限还是 96k，见 zx_codec_clk_set()。
+	 */
+	if (asrc) {
+		for_each_pcm_streams(dir) {
+			stream = dir == SNDRV_PCM_STREAM_PLAYBACK ?
+				 &drv->codec_drv.playback : &drv->codec_drv.capture;
+			stream->rates = SNDRV_PCM_RATE_KNOT;
+			stream->rate_min = 5512;
+			stream->rate_max = 96000;
+		}
+	}
+	codec_dai->driver = &drv->codec_drv;
+}
+
+static void zx_exit(struct snd_soc_pcm_runtime *runtime)
+{
+	struct zxi2s_mc_private *drv = snd_soc_card_get_drvdata(runtime->card);
+
+	if (!drv->codec_dai)
+		return;
+	drv->codec_dai->driver = drv->codec_drv_orig;
+	drv->codec_dai = NULL;
+}
+
 static int zx_init(struct snd_soc_pcm_runtime *runtime)
 {
 	struct snd_soc_card *card = runtime->card;
@@ -155,10 +388,76 @@ static int zx_init(struct snd_soc_pcm_runtime *runtime)
 		dev_err(card->dev, "New Headset Jack failed! (%d)\n", ret);
 		return ret;
 	}
-	return rt5645_set_jack_detect(asoc_rtd_to_codec(runtime, 0)->component,
+
+	if (asrc) {
+		ret = zx_init_asrc(runtime);
+		if (ret)
+			return ret;
+	}
+
+	ret = rt5645_set_jack_detect(asoc_rtd_to_codec(runtime, 0)->component,
 			&headset_jack,
 			&headset_jack,
 			&headset_jack);
+	if (ret)
+		return ret;
+
+	/* 两个 dai_link 共用同一个 codec dai，做一次就够了 */
+	zx_init_caps(runtime);
+	return 0;
+}
+
+/*
+ * MCLK 由 DAPM 管：codec 上电前 prepare MCLK (cpu 驱动立刻打开)，下电后
+ * 先把 codec sysclk 切到内部 RC 时钟，再放掉 MCLK，cpu 驱动空闲一段时间后
+ * 关掉它。codec 不会在没有时钟的情况下上电或失步。
+ *
+ * 流配置好以后 supply 也可能单独下电再上电 (比如播放中所有输出 pin 关掉
+ * 再打开)，不会再有 hw_params：上电时把最后一次 hw_params 的 sysclk 重新
+ * 设回去，缓存里记着 RCCLK，所以一定会发 set_sysclk。PLL1 的寄存器下电时
+ * 不丢，缓存还对就不用重设。
+ */
+static int zx_platform_clock_control(struct snd_soc_dapm_widget *w,
+				     struct snd_kcontrol *k, int event)
+{
+	struct snd_soc_card *card = w->dapm->card;
+	struct zxi2s_mc_private *drv = snd_soc_card_get_drvdata(card);
+	struct zxi2s_mc_clk_state *cs = &drv->clk;
+	struct snd_soc_dai *codec_dai;
+	int ret;
+
+	codec_dai = snd_soc_card_get_codec_dai(card, "rt5645-aif1");
+
+	if (SND_SOC_DAPM_EVENT_ON(event)) {
+		ret = clk_prepare_enable(drv->mclk);
+		if (ret < 0) {
+			dev_err(card->dev, "can't enable mclk: %d\n", ret);
+			return ret;
+		}
+		if (!codec_dai || !cs->rate)
+			return 0;
+		ret = zx_codec_clk_set(codec_dai, cs, &cs->plan, cs->rate);
+		if (ret < 0) {
+			clk_disable_unprepare(drv->mclk);
+			return ret;
+		}
+		cs->restores++;
+		return 0;
+	}
+
+	if (codec_dai) {
+		ret = snd_soc_dai_set_sysclk(codec_dai, RT5645_SCLK_S_RCCLK,
+					     48000 * 512, SND_SOC_CLOCK_IN);
+		if (ret < 0) {
+			dev_err(card->dev, "can't park codec sysclk: %d\n", ret);
+			cs->sysclk_src = -1;
+		} else {
+			cs->sysclk_src = RT5645_SCLK_S_RCCLK;
+			cs->sysclk = 48000 * 512;
+		}
+	}
+	clk_disable_unprepare(drv->mclk);
+	return 0;
 }
 
 // Widget 来描述一个声卡的功能部件 
@@ -169,6 +468,9 @@ static const struct snd_soc_dapm_widget zx_dapm_widgets[] = {
 	SND_SOC_DAPM_SPK("Speakers", NULL),
 	SND_SOC_DAPM_MIC("Headset Mic", NULL),
 	SND_SOC_DAPM_MIC("Int Mic", NULL),
+	SND_SOC_DAPM_SUPPLY("Platform Clock", SND_SOC_NOPM, 0, 0,
+			    zx_platform_clock_control,
+			    SND_SOC_DAPM_PRE_PMU | SND_SOC_DAPM_POST_PMD),
 };
 
 /*
@@ -193,6 +495,12 @@ static const struct snd_soc_dapm_route zx_audio_map[] = {
 	{"Headphones", NULL, "HPOL"},
 	{"Speakers", NULL, "SPOL"},
 	{"Speakers", NULL, "SPOR"},
+
+	/* every endpoint needs MCLK running */
+	{"Headphones", NULL, "Platform Clock"},
+	{"Speakers", NULL, "Platform Clock"},
+	{"Headset Mic", NULL, "Platform Clock"},
+	{"Int Mic", NULL, "Platform Clock"},
 };
 
 static const struct snd_kcontrol_new zx_mc_controls[] = {
@@ -202,15 +510,10 @@ static const struct snd_kcontrol_new zx_mc_controls[] = {
 	SOC_DAPM_PIN_SWITCH("Int Mic"),
 };
 
-static int zx_aif1_startup(struct snd_pcm_substream *substream)
-{
-	return snd_pcm_hw_constraint_single(substream->runtime,
-			SNDRV_PCM_HW_PARAM_RATE, 48000);
-}
 /* TODO: */
 static const struct snd_soc_ops zx_aif1_ops = {
-	.startup = zx_aif1_startup,
 	.hw_params = zx_aif1_hw_params,//a*d 只有这
+	.hw_free = zx_aif1_hw_free,
 };
 
 
@@ -236,6 +539,7 @@ static struct snd_soc_dai_link zx_dailink[] = {
 		.dai_fmt = SND_SOC_DAIFMT_I2S | SND_SOC_DAIFMT_NB_NF
 				| SND_SOC_DAIFMT_CBS_CFS,
 		.init = zx_init, /* playback 多了这个 */
+		.exit = zx_exit,
 		.ops = &zx_aif1_ops,
 		SND_SOC_DAILINK_REG(pcm),
 	},
@@ -266,6 +570,52 @@ static struct snd_soc_card zxi2s_card = {
 	.num_controls = ARRAY_SIZE(zx_mc_controls),
 };
 
+#ifdef CONFIG_DEBUG_FS
+/* codec 时钟缓存：每次 hw_params 实际发出的 codec 时钟调用和耗时 */
+static int zx_clk_show(struct seq_file *m, void *v)
+{
+	struct zxi2s_mc_private *drv = m->private;
+	struct zxi2s_mc_clk_state *cs = &drv->clk;
+
+	seq_printf(m, "sysclk: %s %u, pll %u -> %u\n",
+		   cs->sysclk_src < 0 ? "none" :
+		   cs->sysclk_src == RT5645_SCLK_S_MCLK ? "mclk" :
+		   cs->sysclk_src == RT5645_SCLK_S_RCCLK ? "rcclk" : "pll1",
+		   cs->sysclk, cs->pll_in, cs->pll_out);
+	seq_printf(m, "reconfigs %lu, set_pll %lu, set_sysclk %lu, mclk direct %lu, restores %lu\n",
+		   cs->reconfigs, cs->pll_calls, cs->sysclk_calls, cs->mclk_direct,
+		   cs->restores);
+	seq_printf(m, "hw_params: last %llu ns, max %llu ns\n", cs->last_ns, cs->max_ns);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(zx_clk);
+
+/*
+ * ASRC 模式下每个方向的流数和其中 link plan 不精确的流数，正在跑的流给出
+ * link 的真实速率和误差
+ */
+static int zx_asrc_show(struct seq_file *m, void *v)
+{
+	struct zxi2s_mc_private *drv = m->private;
+	static const char * const dir[] = { "playback", "capture" };
+	int i;
+
+	seq_printf(m, "asrc %s, tolerance %u ppm\n", asrc ? "on" : "off", asrc_tolerance);
+	for (i = 0; i < ARRAY_SIZE(drv->asrc); i++) {
+		struct zxi2s_mc_asrc_stats *st = &drv->asrc[i];
+
+		seq_printf(m, "%s: %lu streams, %lu inexact",
+			   dir[i], st->streams, st->inexact_streams);
+		if (st->running)
+			seq_printf(m, ", running link %u/%u Hz %+d ppm",
+				   st->link_num, st->link_den, st->err_ppm);
+		seq_puts(m, "\n");
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(zx_asrc);
+#endif
+
 static int zx_probe(struct platform_device *pdev)
 {
 	int ret;
@@ -283,6 +633,14 @@ static int zx_probe(struct platform_device *pdev)
 		return -ENODEV;
 	}
 
+	/* cpu 驱动注册 MCLK，还没 probe 就等它 */
+	drv->mclk = devm_clk_get(&pdev->dev, ZXI2S_MCLK_NAME);
+	if (IS_ERR(drv->mclk)) {
+		ret = PTR_ERR(drv->mclk);
+		return ret == -ENOENT ? -EPROBE_DEFER : ret;
+	}
+
+	drv->clk.sysclk_src = -1;
 	snd_soc_card_set_drvdata(card, drv);//card把drv作为私有的driver数据
 										//下面platform把card作为私有数据
 
@@ -296,6 +654,13 @@ static int zx_probe(struct platform_device *pdev)
 				card->name, ret);
 		return ret;
 	}
+
+#ifdef CONFIG_DEBUG_FS
+	debugfs_create_file("asrc", 0444, card->debugfs_card_root, drv,
+			    &zx_asrc_fops);
+	debugfs_create_file("clk", 0444, card->debugfs_card_root, drv,
+			    &zx_clk_fops);
+#endif
 	return 0;
 }
 
@@ -0,0 +1,254 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *      zxi2s_clk_sweep.c - userspace check of the I2S clock planner
+ *
+ *      Copyright(c) 2021 Shanghai Zhaoxin Corporation. All rights reserved.
+ *
+ *	Builds zx_i2s_clk.h as is and checks it against the PLL_TABLE the cpu
+ *	driver used before the planner:
+ *	1, every table row reproduces its rate under the divider model and the
+ *	   planner finds an exact plan for it;
+ *	2, every offered rate x frame combination gets a plan whose codes give
+ *	   the reported rate, error and MCLK;
+ *	3, every rate from 5512 to 192000 Hz for every frame the same way;
+ *	4, whenever some exact codes give an MCLK the codec can take as sysclk
+ *	   (zxi2s_clk_codec_direct), the planner picks the best such MCLK.
+ *	Exit status is the number of failures. "make check" builds and runs it.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "../zx_i2s_clk.h"
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+/* frame bits, rate, LRDIV | BDIV << 4, MDIV, PLLEA; removed from cpu_zx_i2s.c */
+static const int PLL_TABLE[41][5] = {
+	/* 48 bit index = 0, num = 13 */
+	{48, 192000, 2 | 0 << 4, 0x1, 1},
+	{48,  96000, 2 | 2 << 4, 0x0, 1},
+	{48,  48000, 2 | 1 << 4, 0x2, 1},
+	{48,  32000, 2 | 5 << 4, 0x2, 1},
+	{48,  24000, 2 | 2 << 4, 0x2, 1},
+	{48,  16000, 2 | 2 << 4, 0xA, 1},
+	{48,   8000, 2 | 2 << 4, 0xB, 1},
+	{48,   6000, 2 | 2 << 4, 0x4, 1},
+	{48, 176400, 2 | 0 << 4, 0x1, 0},
+	{48,  88200, 2 | 2 << 4, 0x0, 0},
+	{48,  44100, 2 | 1 << 4, 0x2, 0},
+	{48,  22050, 2 | 2 << 4, 0x2, 0},
+	{48,  11025, 2 | 2 << 4, 0x3, 0},
+	/* 32 bit index = 13, num = 14 */
+	{32, 192000, 1 | 4 << 4, 0x1, 1},
+	{32, 144000, 1 | 2 << 4, 0x0, 1},
+	{32,  96000, 1 | 5 << 4, 0x1, 1},
+	{32,  48000, 1 | 5 << 4, 0x2, 1},
+	{32,  32000, 1 | 5 << 4, 0xA, 1},
+	{32,  24000, 1 | 2 << 4, 0xA, 1},
+	{32,  16000, 1 | 5 << 4, 0xB, 1},
+	{32,   8000, 1 | 6 << 4, 0xB, 1},
+	{32,   6000, 1 | 2 << 4, 0xC, 1},
+	{32, 176400, 1 | 4 << 4, 0x1, 0},
+	{32,  88200, 1 | 5 << 4, 0x1, 0},
+	{32,  44100, 1 | 5 << 4, 0x2, 0},
+	{32,  22050, 1 | 2 << 4, 0xA, 0},
+	{32,  11025, 1 | 2 << 4, 0xB, 0},
+	/* 64 bit index = 27, num = 14 */
+	{64, 192000, 0 | 4 << 4, 0x0, 1},
+	{64, 144000, 0 | 0 << 4, 0x1, 1},
+	{64,  96000, 0 | 4 << 4, 0x1, 1},
+	{64,  48000, 0 | 5 << 4, 0x1, 1},
+	{64,  32000, 0 | 5 << 4, 0x9, 1},
+	{64,  24000, 0 | 5 << 4, 0x2, 1},
+	{64,  16000, 0 | 5 << 4, 0xA, 1},
+	{64,   8000, 0 | 5 << 4, 0xB, 1},
+	{64,   6000, 0 | 2 << 4, 0xB, 1},
+	{64, 176400, 0 | 4 << 4, 0x0, 0},
+	{64,  88200, 0 | 4 << 4, 0x1, 0},
+	{64,  44100, 0 | 5 << 4, 0x1, 0},
+	{64,  22050, 0 | 5 << 4, 0x2, 0},
+	{64,  11025, 0 | 2 << 4, 0xA, 0}
+};
+
+/* keep in sync with zxi2s_rates[] in cpu_zx_i2s.c */
+static const unsigned int zxi2s_rates[] = {
+	5512, 6000, 7350, 8000, 11000, 11025, 12000, 14700, 16000, 22050,
+	24000, 29400, 32000, 44100, 48000, 64000, 88200, 96000, 128000,
+	144000, 176400, 192000,
+};
+
+static const unsigned int frames[] = { 32, 48, 64 };
+
+static int failures;
+
+#define fail(fmt, ...)	do {				\
+	printf("FAIL " fmt "\n", ##__VA_ARGS__);	\
+	failures++;					\
+} while (0)
+
+static unsigned int pll_rate(int pllea)
+{
+	return pllea ? ZXI2S_PLL_36M : ZXI2S_PLL_33M;
+}
+
+/* recompute what the plan's codes produce and compare with what it reports */
+static void check_plan(unsigned int rate, unsigned int frame,
+		       const struct zxi2s_clk_plan *p)
+{
+	unsigned int pll = pll_rate(p->pllea);
+	unsigned int div2 = zxi2s_clk_mdiv(p->mdiv) * zxi2s_clk_bdiv2(p->bdiv) * frame;
+	long long diff = 2LL * pll - (long long)rate * div2;
+	int err = (int)(diff * 1000000 / ((long long)rate * div2));
+	unsigned int num, den;
+
+	if (p->lrdiv != zxi2s_clk_lrdiv(frame))
+		fail("%u/%u: lrdiv %u", rate, frame, p->lrdiv);
+	if (p->exact != !diff)
+		fail("%u/%u: exact %d, diff %lld", rate, frame, p->exact, diff);
+	if (p->err_ppm != err)
+		fail("%u/%u: err %d ppm, codes give %d", rate, frame, p->err_ppm, err);
+	if (p->rate != (2 * pll + div2 / 2) / div2)
+		fail("%u/%u: rate %u", rate, frame, p->rate);
+	zxi2s_clk_link_rate(p, frame, &num, &den);
+	if (num != 2 * pll || den != div2)
+		fail("%u/%u: link rate %u/%u", rate, frame, num, den);
+	if (p->mclk != pll / zxi2s_clk_mdiv(p->mdiv))
+		fail("%u/%u: mclk %u", rate, frame, p->mclk);
+	/* MCLK / fs = BDIV * frame, independent of MDIV */
+	if (p->exact && 2 * p->mclk != rate * zxi2s_clk_bdiv2(p->bdiv) * frame)
+		fail("%u/%u: mclk %u is not bdiv x frame fs", rate, frame, p->mclk);
+}
+
+static void check_table(void)
+{
+	struct zxi2s_clk_plan p;
+	unsigned int i, div2;
+
+	for (i = 0; i < ARRAY_SIZE(PLL_TABLE); i++) {
+		unsigned int frame = PLL_TABLE[i][0], rate = PLL_TABLE[i][1];
+		unsigned int lrdiv = PLL_TABLE[i][2] & 0xf, bdiv = PLL_TABLE[i][2] >> 4;
+		unsigned int mdiv = PLL_TABLE[i][3], pllea = PLL_TABLE[i][4];
+
+		div2 = zxi2s_clk_mdiv(mdiv) * zxi2s_clk_bdiv2(bdiv) * frame;
+		if (2ULL * pll_rate(pllea) != (unsigned long long)rate * div2)
+			fail("row %u: %u/%u not exact under the divider model", i, rate, frame);
+		if (zxi2s_clk_lrdiv(frame) != (int)lrdiv)
+			fail("row %u: lrdiv %u", i, lrdiv);
+		if (zxi2s_clk_plan(rate, frame, &p)) {
+			fail("row %u: no plan for %u/%u", i, rate, frame);
+			continue;
+		}
+		if (!p.exact)
+			fail("row %u: %u/%u planned %+d ppm", i, rate, frame, p.err_ppm);
+		check_plan(rate, frame, &p);
+		printf("table %2u %6u: pllea %u mdiv 0x%X bdiv %u -> planner pllea %d mdiv 0x%X bdiv %u, mclk %8u (%ufs)\n",
+		       frame, rate, pllea, mdiv, bdiv, p.pllea, p.mdiv, p.bdiv,
+		       p.mclk, p.mclk / rate);
+	}
+}
+
+static void check_offered(void)
+{
+	struct zxi2s_clk_plan p;
+	unsigned int i, f;
+
+	for (i = 0; i < ARRAY_SIZE(zxi2s_rates); i++) {
+		printf("%6u:", zxi2s_rates[i]);
+		for (f = 0; f < ARRAY_SIZE(frames); f++) {
+			if (zxi2s_clk_plan(zxi2s_rates[i], frames[f], &p)) {
+				fail("no plan for %u/%u", zxi2s_rates[i], frames[f]);
+				continue;
+			}
+			check_plan(zxi2s_rates[i], frames[f], &p);
+			printf("  %2u bit %s%+7d ppm %4ufs %s", frames[f], p.exact ? "=" : "~",
+			       p.err_ppm, p.mclk / zxi2s_rates[i],
+			       p.exact && zxi2s_clk_codec_direct(p.mclk, zxi2s_rates[i]) ?
+			       "mclk" : "pll ");
+		}
+		printf("\n");
+	}
+}
+
+static void check_sweep(void)
+{
+	struct zxi2s_clk_plan p;
+	unsigned int rate, f, exact, worst_rate;
+	int worst;
+
+	for (f = 0; f < ARRAY_SIZE(frames); f++) {
+		exact = 0;
+		worst = 0;
+		worst_rate = 0;
+		for (rate = 5512; rate <= 192000; rate++) {
+			if (zxi2s_clk_plan(rate, frames[f], &p)) {
+				fail("no plan for %u/%u", rate, frames[f]);
+				continue;
+			}
+			check_plan(rate, frames[f], &p);
+			exact += p.exact;
+			if (abs(p.err_ppm) > worst) {
+				worst = abs(p.err_ppm);
+				worst_rate = rate;
+			}
+		}
+		printf("%2u bit frame: %u exact rates in 5512..192000, worst %d ppm at %u\n",
+		       frames[f], exact, worst, worst_rate);
+	}
+}
+
+/* best codec-direct preference over all exact codes, by brute force */
+static int best_direct(unsigned int rate, unsigned int frame)
+{
+	unsigned int p, m, b, div2, pll, best = 0;
+	int pref;
+
+	for (p = 0; p < 2; p++) {
+		pll = pll_rate(p);
+		for (m = 0; m < ZXI2S_CLK_MDIV_CODES; m++) {
+			for (b = 0; b < ZXI2S_CLK_BDIV_CODES; b++) {
+				div2 = zxi2s_clk_mdiv(m) * zxi2s_clk_bdiv2(b) * frame;
+				if (2ULL * pll != (unsigned long long)rate * div2)
+					continue;
+				pref = zxi2s_clk_codec_direct(pll / zxi2s_clk_mdiv(m), rate);
+				if (pref > (int)best)
+					best = pref;
+			}
+		}
+	}
+	return best;
+}
+
+static void check_direct(void)
+{
+	struct zxi2s_clk_plan p;
+	unsigned int rate, f, direct, pll;
+	int best;
+
+	for (f = 0; f < ARRAY_SIZE(frames); f++) {
+		direct = 0;
+		pll = 0;
+		for (rate = 5512; rate <= 192000; rate++) {
+			if (zxi2s_clk_plan(rate, frames[f], &p) || !p.exact)
+				continue;
+			best = best_direct(rate, frames[f]);
+			if (zxi2s_clk_codec_direct(p.mclk, rate) != best)
+				fail("%u/%u: planned %ufs, codec direct preference %d reachable",
+				     rate, frames[f], p.mclk / rate, best);
+			if (best)
+				direct++;
+			else
+				pll++;
+		}
+		printf("%2u bit frame: %u exact rates with MCLK as codec sysclk, %u through the codec PLL\n",
+		       frames[f], direct, pll);
+	}
+}
+
+int main(void)
+{
+	check_table();
+	check_offered();
+	check_sweep();
+	check_direct();
+	printf("%d failures\n", failures);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
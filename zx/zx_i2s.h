@@ -9,10 +9,33 @@
 #ifndef __SOUND_ZHAOXIN_I2S_PRIV_H
 #define __SOUND_ZHAOXIN_I2S_PRIV_H
 
+#include <linux/regmap.h>
+
 #define       ZXI2S_DEVS 3
 #define       ZXI2S_MC_NAME "zhaoxin_i2s_mc"		/* machine device */
 #define       ZXI2S_CPU_NAME "zhaoxin_i2s_cpu"		/* cpu device */
 #define       ZXI2S_DMA_NAME "zhaoxin_i2s_dma"		/* dma device */
+#define       ZXI2S_MCLK_NAME "zxi2s_mclk"		/* cpu driver's MCLK clock and clkdev con_id */
+
+#define       ZXI2S_CHANNELS_MAX 4		/* DACFIFOCFG_CHN_NUM slots, 0 encodes 4 */
+
+/* cpu dai set_clkdiv() ids */
+#define       ZXI2S_CLKDIV_TOLERANCE 0		/* rate error the clock planner may leave, ppm */
+
+/*
+ * 格式由FIFO转换: DACFIFOCFG 做 sign/endian exchange，POP_LEN 支持 8/16/32 bit 容器；
+ * ADCFIFOCFG 只有 16/32 bit 的 POP_LEN，没有转换，capture 只能是 LE 有符号格式。
+ * cpu dai 和 dma component 共用这两组，保证两边声明一致。
+ */
+#define       ZXI2S_PLAYBACK_FORMATS	(SNDRV_PCM_FMTBIT_S8 | SNDRV_PCM_FMTBIT_U8 | \
+		SNDRV_PCM_FMTBIT_S16_LE | SNDRV_PCM_FMTBIT_S16_BE | \
+		SNDRV_PCM_FMTBIT_U16_LE | SNDRV_PCM_FMTBIT_U16_BE | \
+		SNDRV_PCM_FMTBIT_S24_LE | SNDRV_PCM_FMTBIT_S24_BE | \
+		SNDRV_PCM_FMTBIT_U24_LE | SNDRV_PCM_FMTBIT_U24_BE | \
+		SNDRV_PCM_FMTBIT_S32_LE | SNDRV_PCM_FMTBIT_S32_BE | \
+		SNDRV_PCM_FMTBIT_U32_LE | SNDRV_PCM_FMTBIT_U32_BE)
+#define       ZXI2S_CAPTURE_FORMATS	(SNDRV_PCM_FMTBIT_S16_LE | \
+		SNDRV_PCM_FMTBIT_S24_LE | SNDRV_PCM_FMTBIT_S32_LE)
 
 
 /*
@@ -119,32 +142,56 @@ struct zx_platform_data {
 /**************************************************/
 
 
+/*
+ * PCI function 的私有数据。寄存器只映射一次，cpu/dma 两个子设备通过
+ * dev_get_regmap(parent) 共用同一个 regmap，配置寄存器走 cache，
+ * 状态/位置寄存器是 volatile。
+ */
+struct zxi2s_pdata {
+	void __iomem *zxi2s_base;
+	struct resource *res;
+	struct platform_device *pdev[ZXI2S_DEVS];
+	struct regmap *regmap;
+
+	/* real MMIO accesses issued by the regmap, cache hits don't count */
+	unsigned long mmio_reads;
+	unsigned long mmio_writes;
+};
+
 /*
  * macros for easy use
  */
-/* read/write a register, pass without ZXI2S_REG_ prefix */
+static inline unsigned int zxi2s_regmap_read(struct regmap *map, unsigned int reg)
+{
+	unsigned int val = 0;
+
+	regmap_read(map, reg, &val);
+	return val;
+}
+
+/* read/write a register, the access width comes from the register offset */
 #define zxi2s_reg_writel(chip, reg, value) \
-	writel(value, (chip)->regs + reg)
+	regmap_write((chip)->regmap, reg, value)
 #define zxi2s_reg_writew(chip, reg, value) \
-	writew(value, (chip)->regs +  reg)
+	regmap_write((chip)->regmap, reg, value)
 #define zxi2s_reg_writeb(chip, reg, value) \
-	writeb(value, (chip)->regs +  reg)
+	regmap_write((chip)->regmap, reg, value)
 #define zxi2s_reg_readl(chip, reg) \
-	readl((chip)->regs, reg)
+	zxi2s_regmap_read((chip)->regmap, reg)
 #define zxi2s_reg_readw(chip, reg) \
-	readw((chip)->regs,  reg)
+	zxi2s_regmap_read((chip)->regmap, reg)
 #define zxi2s_reg_readb(chip, reg) \
-	readb((chip)->regs,  reg)
-/* update a register, pass without ZXI2S_REG_ prefix */
+	zxi2s_regmap_read((chip)->regmap, reg)
+/* update a register from the cache, no MMIO read unless it is volatile */
 #define zxi2s_reg_updatel(chip, reg, mask, value) \
-	zxi2s_reg_writel(chip, reg, \
-			(zxi2s_reg_readl(chip, reg) & ~(mask)) | (val))
+	regmap_update_bits((chip)->regmap, reg, mask, value)
 #define zxi2s_reg_updatew(chip, reg, mask, value) \
-	zxi2s_reg_writew(chip, reg, \
-			(zxi2s_reg_readw(chip, reg) & ~(mask)) | (val))
-#define zxi2s_reg_updateb(zxi2s, reg, mask, value) \
-	zxi2s_reg_writeb(chip, reg, \
-			(zxi2s_reg_readb(chip, reg) & ~(mask)) | (val))
+	regmap_update_bits((chip)->regmap, reg, mask, value)
+#define zxi2s_reg_updateb(chip, reg, mask, value) \
+	regmap_update_bits((chip)->regmap, reg, mask, value)
+/* write the bits even if the cache says they are already set (MODRST pulses) */
+#define zxi2s_reg_forceb(chip, reg, mask, value) \
+	regmap_write_bits((chip)->regmap, reg, mask, value)
 
 
 
@@ -0,0 +1,212 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *      zx_i2s_clk.h - Zhaoxin I2S clock planner
+ *
+ *      Copyright(c) 2021 Shanghai Zhaoxin Corporation. All rights reserved.
+ *
+ *	时钟链: PLL(PLLEA 选 36.864M/33.8688M) -> MDIV -> MCLK -> BDIV -> BCLK
+ *	-> LRDIV(frame bits) -> WS。
+ *	rate = PLL / (MDIV * BDIV * frame)，MCLK = PLL / MDIV，所以
+ *	MCLK / fs = BDIV * frame，跟 MDIV 无关。
+ *
+ *	The header has no kernel dependencies outside __KERNEL__ so the planner
+ *	can be built and swept in userspace as is.
+*/
+
+#ifndef __SOUND_ZHAOXIN_I2S_CLK_H
+#define __SOUND_ZHAOXIN_I2S_CLK_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/math64.h>
+#define zxi2s_clk_div64(a, b)	div64_s64(a, b)
+#else
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef int64_t s64;
+#define zxi2s_clk_div64(a, b)	((a) / (b))
+#endif
+
+#define ZXI2S_PLL_36M		36864000	/* PLLEA = 1, 48k family */
+#define ZXI2S_PLL_33M		33868800	/* PLLEA = 0, 44.1k family */
+
+#define ZXI2S_CLK_MDIV_CODES	16
+#define ZXI2S_CLK_BDIV_CODES	8
+#define ZXI2S_CLK_LRDIV_CODES	3		/* index of the per-frame tables */
+
+struct zxi2s_clk_plan {
+	unsigned int rate;	/* achieved, rounded to Hz */
+	unsigned int mclk;	/* PLL / MDIV */
+	unsigned int bclk;
+	u8 mdiv;		/* DACIFCFG_MDIV code */
+	u8 bdiv;		/* DACIFCFG_BDIV code */
+	u8 lrdiv;		/* DACIFCFG_LRDIV code */
+	bool pllea;		/* COMSET_SEL_PLLEA */
+	bool exact;
+	int err_ppm;		/* achieved - requested, truncated */
+};
+
+/* MDIV 0-7: 2 << code, 8-15: 3 << (code & 7) */
+static inline unsigned int zxi2s_clk_mdiv(unsigned int code)
+{
+	return code & 8 ? 3U << (code & 7) : 2U << code;
+}
+
+/* BDIV in half steps: 0-3: 1, 2, 4, 8; 4-7: 1.5, 3, 6, 12 */
+static inline unsigned int zxi2s_clk_bdiv2(unsigned int code)
+{
+	return (code & 4 ? 3U : 2U) << (code & 3);
+}
+
+/* LRDIV code of a frame, -EINVAL if the WS divider cannot count it */
+static inline int zxi2s_clk_lrdiv(unsigned int frame_bits)
+{
+	switch (frame_bits) {
+	case 64:
+		return 0;
+	case 32:
+		return 1;
+	case 48:
+		return 2;
+	default:
+		return -EINVAL;
+	}
+}
+
+/* bits per channel slot a sample width is sent with, 0: unsupported */
+static inline unsigned int zxi2s_clk_lrck(unsigned int width)
+{
+	switch (width) {
+	case 8:
+	case 16:
+		return 16;
+	case 20:
+	case 24:
+		return 24;
+	case 32:
+		return 32;
+	default:
+		return 0;
+	}
+}
+
+/* frame bits on the wire, the serializer sends at least two slots */
+static inline unsigned int zxi2s_clk_frame_bits(unsigned int lrck, unsigned int channels)
+{
+	return (channels < 2 ? 2 : channels) * lrck;
+}
+
+/*
+ * rate the link really runs at, as the fraction 2 x PLL / (MDIV x BDIV x
+ * frame) that snd_pcm_hw_params's rate_num/rate_den can carry
+ */
+static inline void zxi2s_clk_link_rate(const struct zxi2s_clk_plan *plan,
+				       unsigned int frame_bits,
+				       unsigned int *num, unsigned int *den)
+{
+	*num = 2 * (plan->pllea ? ZXI2S_PLL_36M : ZXI2S_PLL_33M);
+	*den = zxi2s_clk_mdiv(plan->mdiv) * zxi2s_clk_bdiv2(plan->bdiv) * frame_bits;
+}
+
+/*
+ * MCLK the RT5645 (rl6231_get_clk_info) can divide down to 256fs by itself:
+ * 256fs times 1, 2, 3, 4, 6, 8, 12 or 16. Returns the preference, 0: the
+ * codec needs its PLL. 512fs and 256fs first, they are what the codec runs
+ * on anyway, then the other multiples.
+ */
+static inline int zxi2s_clk_codec_direct(unsigned int mclk, unsigned int rate)
+{
+	if (!rate || mclk % rate || (mclk / rate) % 256)
+		return 0;
+	switch (mclk / rate / 256) {
+	case 2:
+		return 3;
+	case 1:
+		return 2;
+	case 3:
+	case 4:
+	case 6:
+	case 8:
+	case 12:
+	case 16:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * exact plans beat inexact ones, then the smaller error. Between equals the
+ * MCLK the codec can use as sysclk directly wins (zxi2s_clk_codec_direct()),
+ * then the faster MCLK. A 48 bit frame never gets one: MCLK / fs = BDIV x 48
+ * is no multiple of 256 for any BDIV.
+ */
+static inline bool zxi2s_clk_better(const struct zxi2s_clk_plan *a,
+				    const struct zxi2s_clk_plan *b)
+{
+	unsigned int ea = a->err_ppm < 0 ? -a->err_ppm : a->err_ppm;
+	unsigned int eb = b->err_ppm < 0 ? -b->err_ppm : b->err_ppm;
+	int pa = zxi2s_clk_codec_direct(a->mclk, a->rate);
+	int pb = zxi2s_clk_codec_direct(b->mclk, b->rate);
+
+	if (a->exact != b->exact)
+		return a->exact;
+	if (ea != eb)
+		return ea < eb;
+	if (pa != pb)
+		return pa > pb;
+	return a->mclk > b->mclk;
+}
+
+/*
+ * Find the dividers closest to @rate for a @frame_bits frame. Walks both
+ * PLLs and every MDIV/BDIV code, 256 candidates. Returns -EINVAL if the
+ * frame has no LRDIV code or @rate is 0; the caller decides whether
+ * plan->err_ppm is acceptable.
+ */
+static inline int zxi2s_clk_plan(unsigned int rate, unsigned int frame_bits,
+				 struct zxi2s_clk_plan *plan)
+{
+	static const unsigned int plls[] = { ZXI2S_PLL_33M, ZXI2S_PLL_36M };
+	struct zxi2s_clk_plan c;
+	int lrdiv = zxi2s_clk_lrdiv(frame_bits);
+	unsigned int p, m, b;
+	bool found = false;
+
+	if (lrdiv < 0 || !rate)
+		return -EINVAL;
+
+	for (p = 0; p < 2; p++) {
+		for (m = 0; m < ZXI2S_CLK_MDIV_CODES; m++) {
+			for (b = 0; b < ZXI2S_CLK_BDIV_CODES; b++) {
+				/* everything doubled to keep the half BDIV steps integer */
+				u32 div2 = zxi2s_clk_mdiv(m) * zxi2s_clk_bdiv2(b) * frame_bits;
+				s64 want = (s64)rate * div2;
+				s64 diff = 2 * (s64)plls[p] - want;
+
+				c.rate = (2 * plls[p] + div2 / 2) / div2;
+				if (!c.rate)
+					continue;
+				c.mclk = plls[p] / zxi2s_clk_mdiv(m);
+				c.bclk = c.rate * frame_bits;
+				c.mdiv = m;
+				c.bdiv = b;
+				c.lrdiv = lrdiv;
+				c.pllea = p;
+				c.exact = !diff;
+				c.err_ppm = zxi2s_clk_div64(diff * 1000000, want);
+				if (!found || zxi2s_clk_better(&c, plan)) {
+					*plan = c;
+					found = true;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+#endif /* __SOUND_ZHAOXIN_I2S_CLK_H */